@@ -0,0 +1,326 @@
+// The final version blocks in main until every thread has joined. A
+// service answering "best estimate within 50ms" or dropping the work
+// when the client disconnects can't use it like that. This version
+// wraps the kernel of the final version in an asynchronous interface:
+//
+//  - simulate_async(n, num_threads, deadline, token) starts the
+//    simulation in the background and returns a SimulationHandle right
+//    away,
+//  - the handle holds a std::future with the final Result, which is
+//    either complete, cancelled or cut short by the deadline, and in
+//    every case contains what was simulated up to that point,
+//  - handle.snapshot() returns the results so far (sessions done,
+//    running maximum, partial histogram) at any time. The workers
+//    publish a block's maximum before its sessions, so a snapshot's
+//    maximum may already include a block its session count doesn't.
+//    With the histogram the session count is its sum, so the two
+//    always agree,
+//  - a CancellationToken can be shared with whoever may want to stop
+//    the simulation, handle.cancel() does the same, and so does
+//    dropping the handle (otherwise the destructor of the std::async
+//    future would wait for all n sessions).
+//
+// The workers run the hot loop of the final version on blocks of 2^16
+// iterations (2^18 sessions) and only between blocks publish their
+// progress and look at the token and the clock, so the loop itself is
+// unchanged. The histogram costs 4 extracts and 4 increments per
+// iteration, so it is only kept with simulate_async<true>.
+//
+// The random words come from xoshiro256++ instead of the Xorshift256 of
+// the final version. ANDing consecutive xorshift outputs gives sessions
+// with a variance of ~40.3 instead of 43.3 (see
+// graveler_lock_block_max.cpp), and every estimate would inherit that.
+
+// Performance on 1B (single thread): ~6.5sec without the histogram
+// (final version ~6.1sec, the difference is the generator), ~6.9sec with it
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <future>
+#include <memory>
+#include <immintrin.h>
+#include <stdint.h>
+
+const int ROLLS = 231;
+const long long BLOCK_ITERATIONS = 1 << 16;
+
+typedef std::chrono::steady_clock Clock;
+
+uint64_t splitmix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+class Xoshiro256pp {
+public:
+    Xoshiro256pp(__m256i seed) {
+        uint64_t lanes[4], words[4][4];
+        _mm256_storeu_si256((__m256i*)lanes, seed);
+        for (int i = 0; i < 4; ++i) {
+            for (int j = 0; j < 4; ++j) {
+                words[j][i] = splitmix64(lanes[i] + j);
+            }
+        }
+        for (int j = 0; j < 4; ++j) {
+            s[j] = _mm256_loadu_si256((__m256i*)words[j]);
+        }
+    }
+
+    __m256i next() {
+        __m256i result = _mm256_add_epi64(rotl(_mm256_add_epi64(s[0], s[3]), 23), s[0]);
+        __m256i t = _mm256_slli_epi64(s[1], 17);
+        s[2] = _mm256_xor_si256(s[2], s[0]);
+        s[3] = _mm256_xor_si256(s[3], s[1]);
+        s[1] = _mm256_xor_si256(s[1], s[2]);
+        s[0] = _mm256_xor_si256(s[0], s[3]);
+        s[2] = _mm256_xor_si256(s[2], t);
+        s[3] = rotl(s[3], 45);
+
+        return result;
+    }
+
+private:
+    static __m256i rotl(__m256i x, int k) {
+        return _mm256_or_si256(_mm256_slli_epi64(x, k), _mm256_srli_epi64(x, 64 - k));
+    }
+
+    __m256i s[4];
+};
+
+__m256i inline popcnt_epi8_mask(__m256i v) {
+    __m256i lookup = _mm256_setr_epi8 (0 , 1 , 1 , 2 , 1 , 2 , 2 , 3 , 1 , 2 ,
+    2 , 3 , 2 , 3 , 3 , 4 , 0 , 1 , 1 , 2 , 1 , 2 , 2 , 3 ,
+    1 , 2 , 2 , 3 , 2 , 3 , 3 , 4) ;
+    __m256i low_mask = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v, low_mask) ;
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi32(v, 4), _mm256_set1_epi64x(0x070F));
+    __m256i popcnt1 = _mm256_shuffle_epi8(lookup, lo);
+    __m256i popcnt2 = _mm256_shuffle_epi8(lookup, hi);
+    return _mm256_add_epi8(popcnt1, popcnt2);
+}
+
+__m256i inline popcnt_epi8(__m256i v) {
+    __m256i lookup = _mm256_setr_epi8 (0 , 1 , 1 , 2 , 1 , 2 , 2 , 3 , 1 , 2 ,
+    2 , 3 , 2 , 3 , 3 , 4 , 0 , 1 , 1 , 2 , 1 , 2 , 2 , 3 ,
+    1 , 2 , 2 , 3 , 2 , 3 , 3 , 4) ;
+    __m256i low_mask = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v,low_mask ) ;
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi32(v, 4), low_mask);
+    __m256i popcnt1 = _mm256_shuffle_epi8(lookup, lo);
+    __m256i popcnt2 = _mm256_shuffle_epi8(lookup, hi);
+    return _mm256_add_epi8(popcnt1, popcnt2);
+}
+
+class CancellationToken {
+public:
+    CancellationToken() : flag(std::make_shared<std::atomic<bool>>(false)) {}
+
+    void cancel() { flag->store(true, std::memory_order_relaxed); }
+    bool cancelled() const { return flag->load(std::memory_order_relaxed); }
+
+private:
+    std::shared_ptr<std::atomic<bool>> flag;
+};
+
+enum class Status { Running, Completed, Cancelled, DeadlineExceeded };
+
+struct Result {
+    Status status;
+    long long sessions;
+    int max_value;
+    std::vector<uint64_t> histogram;
+};
+
+// Shared between the handle and the workers, updated once per block.
+struct Progress {
+    bool with_histogram = false;
+    std::atomic<long long> sessions{0};
+    std::atomic<int> max_value{0};
+    std::atomic<uint64_t> histogram[ROLLS + 1] = {};
+
+    Result snapshot(Status status) const {
+        Result result{status, sessions, max_value, std::vector<uint64_t>(ROLLS + 1)};
+        long long histogram_sessions = 0;
+        for (int k = 0; k <= ROLLS; ++k) {
+            result.histogram[k] = histogram[k];
+            histogram_sessions += result.histogram[k];
+        }
+        // The histogram is published before sessions, count what it holds.
+        if (with_histogram) {
+            result.sessions = histogram_sessions;
+        }
+        return result;
+    }
+};
+
+class SimulationHandle {
+public:
+    SimulationHandle(std::shared_ptr<Progress> progress, CancellationToken token, std::future<Result> result)
+        : progress(progress), token(token), result(std::move(result)) {}
+    SimulationHandle(const SimulationHandle&) = delete;
+    SimulationHandle& operator=(const SimulationHandle&) = delete;
+    SimulationHandle(SimulationHandle&&) = default;
+
+    SimulationHandle& operator=(SimulationHandle&& other) {
+        if (result.valid()) {
+            token.cancel();
+        }
+        progress = std::move(other.progress);
+        token = std::move(other.token);
+        result = std::move(other.result);
+        return *this;
+    }
+
+    // A handle that is dropped before its result was taken stops the
+    // simulation, so the future's destructor only waits for the current
+    // block.
+    ~SimulationHandle() {
+        if (result.valid()) {
+            token.cancel();
+        }
+    }
+
+    void cancel() { token.cancel(); }
+    Result snapshot() const { return progress->snapshot(Status::Running); }
+    std::future<Result>& future() { return result; }
+
+private:
+    std::shared_ptr<Progress> progress;
+    CancellationToken token;
+    std::future<Result> result;
+};
+
+template <bool HISTOGRAM>
+void thread_action(long long n, Progress& progress, CancellationToken token, Clock::time_point deadline, __m256i seed){
+    Xoshiro256pp gen(seed);
+    for (long long done = 0; done < n; done += BLOCK_ITERATIONS) {
+        if (token.cancelled()) {
+            return;
+        }
+        if (Clock::now() >= deadline) {
+            return;
+        }
+        long long block = (n - done < BLOCK_ITERATIONS) ? n - done : BLOCK_ITERATIONS;
+        uint64_t local_histogram[4][ROLLS + 1] = {};
+        __m256i local_max_epi8 = _mm256_setzero_si256();
+        for (long long i = 0; i < block; ++i) {
+            __m256i total = popcnt_epi8_mask(_mm256_and_si256(gen.next(), gen.next()));
+            for (int j = 0; j < 3; ++j) {
+                total = _mm256_add_epi8(popcnt_epi8(_mm256_and_si256(gen.next(), gen.next())), total);
+            }
+            total = _mm256_sad_epu8(total, _mm256_setzero_si256());
+            local_max_epi8 = _mm256_max_epu8(local_max_epi8, total);
+            if (HISTOGRAM) {
+                local_histogram[0][_mm256_extract_epi64(total, 0)]++;
+                local_histogram[1][_mm256_extract_epi64(total, 1)]++;
+                local_histogram[2][_mm256_extract_epi64(total, 2)]++;
+                local_histogram[3][_mm256_extract_epi64(total, 3)]++;
+            }
+        }
+        uint64_t result[4];
+        _mm256_storeu_si256((__m256i*)result, local_max_epi8);
+        for (int i = 1; i < 4; ++i){
+            result[0] = (result[i] > result[0]) ? result[i] : result[0];
+        }
+        int current = progress.max_value;
+        while ((int)result[0] > current && !progress.max_value.compare_exchange_weak(current, (int)result[0])) {}
+        for (int k = 0; HISTOGRAM && k <= ROLLS; ++k) {
+            uint64_t count = local_histogram[0][k] + local_histogram[1][k] + local_histogram[2][k] + local_histogram[3][k];
+            if (count > 0) {
+                progress.histogram[k].fetch_add(count, std::memory_order_relaxed);
+            }
+        }
+        progress.sessions.fetch_add(4 * block);
+    }
+}
+
+// With HISTOGRAM = false the histogram of the result stays all zeros.
+template <bool HISTOGRAM = false>
+SimulationHandle simulate_async(long long n, int num_threads, Clock::time_point deadline = Clock::time_point::max(),
+                                CancellationToken token = CancellationToken()) {
+    auto progress = std::make_shared<Progress>();
+    progress->with_histogram = HISTOGRAM;
+    std::future<Result> result = std::async(std::launch::async, [=]() {
+        std::vector<std::thread> threads;
+        long long chunk_size = n / num_threads / 4;
+        for (int i = 0; i < num_threads; ++i) {
+            threads.emplace_back(thread_action<HISTOGRAM>, chunk_size, std::ref(*progress), token, deadline, _mm256_setr_epi32(0,42 + 4 * i,0,43 + 4 * i,0,44 + 4 * i,0,45 + 4 * i));
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        Status status = (progress->sessions == 4 * chunk_size * num_threads) ? Status::Completed
+                      : token.cancelled() ? Status::Cancelled
+                      : Status::DeadlineExceeded;
+        return progress->snapshot(status);
+    });
+    return SimulationHandle(progress, token, std::move(result));
+}
+
+const char* status_name(Status status) {
+    switch (status) {
+        case Status::Running: return "Running";
+        case Status::Completed: return "Completed";
+        case Status::Cancelled: return "Cancelled";
+        case Status::DeadlineExceeded: return "Deadline Exceeded";
+    }
+    return "";
+}
+
+void print_result(const char* title, const Result& result, Clock::time_point start_time) {
+    auto total_time = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start_time);
+    std::cout << title << ": " << status_name(result.status) << std::endl;
+    std::cout << "  Highest Ones Roll: " << result.max_value << std::endl;
+    std::cout << "  Number of Roll Sessions: " << result.sessions << std::endl;
+    std::cout << "  Total Elapsed Time: " << total_time.count() * 1e-3 << "s" << std::endl;
+}
+
+int main() {
+    long long n = 1e9;
+
+    int num_threads = std::thread::hardware_concurrency();
+    std::cout << "On " << num_threads << " Threads" << std::endl;
+
+    // Best estimate within 50ms.
+    auto start_time = Clock::now();
+    SimulationHandle estimate = simulate_async(n, num_threads, start_time + std::chrono::milliseconds(50));
+    print_result("Within 50ms", estimate.future().get(), start_time);
+
+    // A client that watches the progress and disconnects after 200ms.
+    start_time = Clock::now();
+    CancellationToken client;
+    SimulationHandle watched = simulate_async<true>(n, num_threads, Clock::time_point::max(), client);
+    for (int i = 0; i < 4; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        Result partial = watched.snapshot();
+        std::cout << "  Partial: " << partial.sessions << " Sessions, Highest Ones Roll " << partial.max_value
+                  << ", " << partial.histogram[ROLLS / 4] << " Sessions With " << ROLLS / 4 << " Ones" << std::endl;
+    }
+    client.cancel();
+    print_result("Client Disconnected", watched.future().get(), start_time);
+
+    // A client that just goes away after 50ms, dropping the handle.
+    start_time = Clock::now();
+    {
+        SimulationHandle dropped = simulate_async(n, num_threads);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    auto drop_time = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start_time);
+    std::cout << "Handle Dropped After 50ms, Returned After: " << drop_time.count() * 1e-3 << "s" << std::endl;
+
+    // The full run, without and with the histogram.
+    start_time = Clock::now();
+    SimulationHandle full = simulate_async(n, num_threads);
+    print_result("Full Run", full.future().get(), start_time);
+
+    start_time = Clock::now();
+    SimulationHandle full_histogram = simulate_async<true>(n, num_threads);
+    print_result("Full Run With Histogram", full_histogram.future().get(), start_time);
+
+    return 0;
+}
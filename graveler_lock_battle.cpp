@@ -0,0 +1,307 @@
+// The 231 D4 rolls are a simplification of the actual soft lock. In the
+// battle Graveler is paralyzed, so on every turn it is fully paralyzed
+// with probability 1/4, and otherwise it picks one of its moves. This
+// version simulates a slightly richer turn by turn model:
+//
+//  - if Graveler is asleep it can't move, the turn is safe and its
+//    sleep counter goes down by one,
+//  - otherwise it is fully paralyzed with probability 1/4 (safe),
+//  - otherwise it picks one of its 4 moves. Self-Destruct and Explosion
+//    end the run, Rock Throw and Defense Curl don't (safe),
+//  - on every turn Graveler starts awake the player uses a sleep move
+//    with probability 1/2, putting it to sleep for 0..7 turns (0 being
+//    a miss).
+//
+// The result of a battle is the number of turns Graveler survives, i.e.
+// the safe turns before the first Self-Destruct or Explosion (231 being
+// the soft lock). With sleep and the harmless moves switched off only
+// paralysis keeps it from moving, so every turn is survived with
+// probability 1/4 and the result is geometric: mean 1/3, variance 4/9
+// (the cap at 231 doesn't show). The program runs that configuration
+// too.
+//
+// Both configurations are also run through a plain scalar simulation of
+// the same rules on 1/100 of the battles, and the program fails if the
+// mean or the variance of the two differ by more than 5 standard errors.
+//
+// The bit-AND trick is taken to its end here: every bit of a 256 bit
+// word is its own battle, so one register holds 256 battles. A random
+// event with probability 1/4 is the AND of two words, a 3 bit sleep
+// counter is stored as 3 bit-planes, the battles still running as one
+// alive plane and the count of survived turns as 8 bit-planes, which are
+// decremented and incremented with the usual ripple-carry logic. Every
+// turn is branchless and costs 7 random words (2 in the D4
+// configuration) for all 256 battles. Once all 256 battles have ended
+// the remaining turns are skipped.
+//
+// The random words come from xoshiro256++ rather than Xorshift256 since
+// ANDing consecutive xorshift outputs is correlated (see
+// graveler_lock_block_max.cpp).
+
+// The counters are turned back into one byte per battle with pdep, so
+// besides AVX2 this needs BMI2 (-mavx2 -mbmi2, or -march=native).
+
+// Performance on 1B battles (single thread):
+//   D4 model: ~2.7sec (~360M battles/sec)
+//   battle model: ~5.6sec (~180M battles/sec)
+
+#include <iostream>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <immintrin.h>
+#include <stdint.h>
+
+const int TURNS = 231;
+const int COUNTER_BITS = 8;
+const int BATTLES_PER_VECTOR = 256;
+
+uint64_t splitmix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+class Xoshiro256pp {
+public:
+    Xoshiro256pp(__m256i seed) {
+        uint64_t lanes[4], words[4][4];
+        _mm256_storeu_si256((__m256i*)lanes, seed);
+        for (int i = 0; i < 4; ++i) {
+            for (int j = 0; j < 4; ++j) {
+                words[j][i] = splitmix64(lanes[i] + j);
+            }
+        }
+        for (int j = 0; j < 4; ++j) {
+            s[j] = _mm256_loadu_si256((__m256i*)words[j]);
+        }
+    }
+
+    __m256i next() {
+        __m256i result = _mm256_add_epi64(rotl(_mm256_add_epi64(s[0], s[3]), 23), s[0]);
+        __m256i t = _mm256_slli_epi64(s[1], 17);
+        s[2] = _mm256_xor_si256(s[2], s[0]);
+        s[3] = _mm256_xor_si256(s[3], s[1]);
+        s[1] = _mm256_xor_si256(s[1], s[2]);
+        s[0] = _mm256_xor_si256(s[0], s[3]);
+        s[2] = _mm256_xor_si256(s[2], t);
+        s[3] = rotl(s[3], 45);
+
+        return result;
+    }
+
+private:
+    static __m256i rotl(__m256i x, int k) {
+        return _mm256_or_si256(_mm256_slli_epi64(x, k), _mm256_srli_epi64(x, 64 - k));
+    }
+
+    __m256i s[4];
+};
+
+// Simulates 256 battles per iteration and adds the number of turns every
+// battle survived to the histogram.
+template <bool BATTLE>
+void thread_action(long long n, std::vector<uint64_t>& histogram, __m256i seed){
+    Xoshiro256pp gen(seed);
+    for (long long i = 0; i < n; ++i) {
+        __m256i sleep[3] = {_mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256()};
+        __m256i alive = _mm256_set1_epi8(-1);
+        __m256i safe_turns[COUNTER_BITS];
+        for (int k = 0; k < COUNTER_BITS; ++k) {
+            safe_turns[k] = _mm256_setzero_si256();
+        }
+        for (int turn = 0; turn < TURNS && !_mm256_testz_si256(alive, alive); ++turn) {
+            __m256i safe = _mm256_and_si256(gen.next(), gen.next());
+            __m256i asleep = _mm256_setzero_si256();
+            if (BATTLE) {
+                asleep = _mm256_or_si256(_mm256_or_si256(sleep[0], sleep[1]), sleep[2]);
+                // Moves 0 and 1 are Self-Destruct and Explosion, the other
+                // two are harmless, so one random bit decides.
+                __m256i harmless_move = gen.next();
+                safe = _mm256_or_si256(_mm256_or_si256(safe, asleep), harmless_move);
+            }
+
+            // The battle ends on the first unsafe turn.
+            alive = _mm256_and_si256(alive, safe);
+
+            // safe_turns += alive, ripple carry through the bit-planes.
+            __m256i carry = alive;
+            for (int k = 0; k < COUNTER_BITS; ++k) {
+                __m256i next_carry = _mm256_and_si256(safe_turns[k], carry);
+                safe_turns[k] = _mm256_xor_si256(safe_turns[k], carry);
+                carry = next_carry;
+            }
+
+            if (BATTLE) {
+                // sleep -= 1 where asleep.
+                __m256i borrow = asleep;
+                for (int k = 0; k < 3; ++k) {
+                    __m256i next_borrow = _mm256_andnot_si256(sleep[k], borrow);
+                    sleep[k] = _mm256_xor_si256(sleep[k], borrow);
+                    borrow = next_borrow;
+                }
+                // sleep = 0..7 where awake and the sleep move was used. Every
+                // bit is its own battle, so this has to be a bitwise select
+                // (blendv would pick whole bytes, i.e. 8 battles at once).
+                __m256i put_to_sleep = _mm256_andnot_si256(asleep, gen.next());
+                for (int k = 0; k < 3; ++k) {
+                    sleep[k] = _mm256_or_si256(_mm256_andnot_si256(put_to_sleep, sleep[k]),
+                                               _mm256_and_si256(put_to_sleep, gen.next()));
+                }
+            }
+        }
+
+        // Gather the 8 bit-planes of every 8 battles into 8 bytes.
+        uint64_t planes[COUNTER_BITS][4];
+        for (int k = 0; k < COUNTER_BITS; ++k) {
+            _mm256_storeu_si256((__m256i*)planes[k], safe_turns[k]);
+        }
+        for (int w = 0; w < 4; ++w) {
+            for (int b = 0; b < 64; b += 8) {
+                uint64_t values = 0;
+                for (int k = 0; k < COUNTER_BITS; ++k) {
+                    values |= _pdep_u64(planes[k][w] >> b, 0x0101010101010101ULL << k);
+                }
+                for (int j = 0; j < 8; ++j) {
+                    histogram[(values >> (8 * j)) & 0xff]++;
+                }
+            }
+        }
+    }
+}
+
+// Scalar reference of the same model, one battle at a time with an
+// ordinary sleep counter. The 7 random bits of every turn come from one
+// splitmix64 output, so it doesn't share anything with the bit-sliced
+// version but the rules.
+template <bool BATTLE>
+void reference_action(long long n, std::vector<uint64_t>& histogram, uint64_t seed){
+    for (long long i = 0; i < n; ++i) {
+        int sleep = 0, safe_turns = 0;
+        for (int turn = 0; turn < TURNS; ++turn) {
+            uint64_t bits = splitmix64(seed++);
+            bool asleep = sleep > 0;
+            bool safe = (bits & 3) == 3;
+            if (BATTLE) {
+                safe = safe || asleep || ((bits >> 2) & 1);
+            }
+            if (!safe) {
+                break;
+            }
+            safe_turns++;
+            if (BATTLE) {
+                if (asleep) {
+                    sleep--;
+                } else if ((bits >> 3) & 1) {
+                    sleep = (bits >> 4) & 7;
+                }
+            }
+        }
+        histogram[safe_turns]++;
+    }
+}
+
+struct Moments {
+    double battles, mean, variance, fourth;  // fourth central moment
+    int max_value;
+};
+
+Moments moments(const std::vector<uint64_t>& histogram) {
+    Moments m = {0, 0, 0, 0, 0};
+    for (int k = 0; k <= TURNS; ++k) {
+        m.battles += histogram[k];
+        m.mean += (double)k * histogram[k];
+        m.max_value = (histogram[k] > 0) ? k : m.max_value;
+    }
+    m.mean /= m.battles;
+    for (int k = 0; k <= TURNS; ++k) {
+        double d = k - m.mean;
+        m.variance += d * d * histogram[k];
+        m.fourth += d * d * d * d * histogram[k];
+    }
+    m.variance /= m.battles;
+    m.fourth /= m.battles;
+    return m;
+}
+
+// Both means and variances have to agree within 5 standard errors.
+bool matches(const Moments& a, const Moments& b) {
+    double mean_error = std::sqrt(a.variance / a.battles + b.variance / b.battles);
+    double variance_error = std::sqrt((a.fourth - a.variance * a.variance) / a.battles
+                                    + (b.fourth - b.variance * b.variance) / b.battles);
+    return std::fabs(a.mean - b.mean) <= 5 * mean_error && std::fabs(a.variance - b.variance) <= 5 * variance_error;
+}
+
+// Runs the model bit-sliced on n battles and the scalar reference on
+// reference_n battles, prints both and returns whether they match.
+template <bool BATTLE>
+bool run_model(const char* name, long long n, long long reference_n, int num_threads) {
+    std::vector<std::thread> threads;
+    std::vector<std::vector<uint64_t>> histograms(num_threads, std::vector<uint64_t>(TURNS + 1));
+    long long chunk_size = n / num_threads / BATTLES_PER_VECTOR;
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    for (int i = 0; i < num_threads; ++i) {
+        threads.emplace_back(thread_action<BATTLE>, chunk_size, std::ref(histograms[i]), _mm256_setr_epi32(0,42 + 4 * i,0,43 + 4 * i,0,44 + 4 * i,0,45 + 4 * i));
+    }
+
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    auto total_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::high_resolution_clock::now() - start_time);
+
+    std::vector<std::vector<uint64_t>> reference_histograms(num_threads, std::vector<uint64_t>(TURNS + 1));
+    threads.clear();
+    for (int i = 0; i < num_threads; ++i) {
+        threads.emplace_back(reference_action<BATTLE>, reference_n / num_threads, std::ref(reference_histograms[i]), (uint64_t)i << 48);
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    std::vector<uint64_t> histogram(TURNS + 1), reference_histogram(TURNS + 1);
+    for (int k = 0; k <= TURNS; ++k) {
+        for (int i = 0; i < num_threads; ++i) {
+            histogram[k] += histograms[i][k];
+            reference_histogram[k] += reference_histograms[i][k];
+        }
+    }
+    Moments simulated = moments(histogram);
+    Moments reference = moments(reference_histogram);
+    bool same = matches(simulated, reference);
+
+    std::cout << "Model: " << name << std::endl;
+    std::cout << "  Highest Turns Survived: " << simulated.max_value << std::endl;
+    std::cout << "  Mean Turns Survived: " << simulated.mean << " (Variance " << simulated.variance << ")" << std::endl;
+    std::cout << "  Number of Battles: " << (long long)simulated.battles << std::endl;
+    std::cout << "  Total Elapsed Time: " << total_time.count() * 1e-3 << "s" << std::endl;
+    std::cout << "  Battles per Second: " << simulated.battles / (total_time.count() * 1e-3) << std::endl;
+    std::cout << "  Reference Mean Turns Survived: " << reference.mean << " (Variance " << reference.variance
+              << ", " << (long long)reference.battles << " Battles)" << std::endl;
+    std::cout << "  Matches Reference: " << (same ? "yes" : "no") << std::endl;
+    std::cout << "  Turns Survived Histogram:" << std::endl;
+    for (int k = 0; k <= TURNS; ++k) {
+        if (histogram[k] > 0) {
+            std::cout << "    " << k << ": " << histogram[k] << std::endl;
+        }
+    }
+    return same;
+}
+
+int main() {
+    long long n = 1e9;
+    long long reference_n = n / 100;
+
+    int num_threads = std::thread::hardware_concurrency();
+
+    std::cout << "On " << num_threads << " Threads" << std::endl;
+    bool same = run_model<false>("D4 (Expected Mean 0.3333, Variance 0.4444)", n, reference_n, num_threads);
+    same = run_model<true>("Battle", n, reference_n, num_threads) && same;
+
+    return same ? 0 : 1;
+}
@@ -0,0 +1,319 @@
+# Benchmark driver for every version in the repository.
+#
+# The performance numbers in the comments of the versions were all
+# measured on one 12 thread laptop, with whatever n the version was
+# written for. This script runs every version (and the newer engines)
+# on the current host over a grid of n and thread counts, with
+# repetitions, and records the wall time, the time the program reports
+# itself, sessions per second, parallel efficiency and the highest roll.
+#
+# The versions hardcode n and use all hardware threads, so the script
+# copies each source, replaces n (and the thread count, for the
+# multithreaded versions) and compiles the copy. The sources themselves
+# are left untouched.
+#
+# Strong scaling: fixed n, growing number of threads,
+#   efficiency = time(1 thread) / (threads * time(threads)).
+# Weak scaling: n = base * threads,
+#   efficiency = time(1 thread, base) / time(threads, base * threads).
+#
+# Usage:
+#   python3 graveler_lock_bench.py --versions final,table --n 1e8,1e9 \
+#       --threads 1,2,4,8 --reps 5 --csv bench.csv --json bench.json
+# writes every run to bench.csv, the medians and efficiencies per
+# (version, mode, n, threads) to bench.summary.csv, and both to bench.json.
+
+import argparse
+import csv
+import json
+import os
+import re
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+ROOT = os.path.dirname(os.path.abspath(__file__))
+
+# Output lines of the versions. Engines that print something else, or
+# several runs, override them below.
+PATTERNS = {
+    "result": r"Highest Ones Roll: (\d+)",
+    "sessions": r"Number of Roll Sessions: (\d+)",
+    "reported_s": r"Total Elapsed Time: ([0-9.e+-]+)s",
+}
+
+# (name, path, maximum n the version can handle, multithreaded, output
+# patterns that differ from PATTERNS). graveler_lock_check.cpp is a
+# correctness check rather than an engine and isn't benchmarked.
+INT_MAX = 2**31 - 1
+VERSIONS = [
+    ("py_1", "graveler_lock_py_cpp/graveler_lock.py", None, False, {}),
+    ("py_2", "graveler_lock_py_cpp/graveler_lock_2.py", None, False, {}),
+    ("py_perf", "graveler_lock_py_cpp/graveler_lock_perf.py", None, True, {}),
+    ("cpp_1", "graveler_lock_py_cpp/graveler_lock.cpp", INT_MAX, False, {}),
+    ("cpp_2", "graveler_lock_py_cpp/graveler_lock_2.cpp", INT_MAX, False, {}),
+    ("cpp_3", "graveler_lock_py_cpp/graveler_lock_3.cpp", INT_MAX, False, {}),
+    ("cpp_4", "graveler_lock_py_cpp/graveler_lock_4.cpp", INT_MAX, False, {}),
+    ("cpp_5", "graveler_lock_py_cpp/graveler_lock_5.cpp", INT_MAX, False, {}),
+    ("cpp_6", "graveler_lock_py_cpp/graveler_lock_6.cpp", INT_MAX, False, {}),
+    ("cpp_7", "graveler_lock_py_cpp/graveler_lock_7.cpp", INT_MAX, False, {}),
+    ("cpp_8", "graveler_lock_py_cpp/graveler_lock_8.cpp", INT_MAX, False, {}),
+    ("cpp_9", "graveler_lock_py_cpp/graveler_lock_9.cpp", INT_MAX, True, {}),
+    ("cpp_10", "graveler_lock_py_cpp/graveler_lock_10.cpp", None, True, {}),
+    # int chunk_size = n / num_threads / 4
+    ("cpp_11", "graveler_lock_py_cpp/graveler_lock_11.cpp", 4 * INT_MAX, True, {}),
+    ("final", "graveler_lock_final.cpp", 4 * INT_MAX, True, {}),
+    ("table", "graveler_lock_table.cpp", None, True, {}),
+    ("block_max", "graveler_lock_block_max.cpp", None, True, {}),
+    # The Xorshift256 "Same Core" run, i.e. the kernel of the final
+    # version on 8 KiB blocks.
+    ("pipeline", "graveler_lock_pipeline.cpp", None, True,
+     {"reported_s": r"Same Core: ([0-9.e+-]+)s"}),
+    # The D4 model, which is the first one printed; n counts battles.
+    ("battle", "graveler_lock_battle.cpp", None, True,
+     {"result": r"Highest Turns Survived: (\d+)", "sessions": r"Number of Battles: (\d+)"}),
+    # The full run, the last one printed.
+    ("async", "graveler_lock_async.cpp", None, True,
+     {"result": r"Full Run: .*\n  Highest Ones Roll: (\d+)",
+      "sessions": r"Full Run: .*\n.*\n  Number of Roll Sessions: (\d+)",
+      "reported_s": r"Full Run: .*\n.*\n.*\n  Total Elapsed Time: ([0-9.e+-]+)s"}),
+    # The whole sweep; the result is the highest roll of the largest k,
+    # the table row just before the number of sessions.
+    ("sweep", "graveler_lock_sweep.cpp", None, True,
+     {"result": r"^\d+  (\d+).*\nNumber of Roll Sessions", "reported_s": r"Sweep Elapsed Time: ([0-9.e+-]+)s"}),
+]
+
+# The py_cpp sources have CRLF line endings, which are kept.
+CPP_N = re.compile(r"^(\s*)(int|long long) n = [^;]+;", re.M)
+CPP_THREADS = re.compile(r"int num_threads = std::thread::hardware_concurrency\(\);")
+PY_N = [re.compile(r"^(\s*)n = (int\([^)]*\)|\d+)(?=\r?$)", re.M), re.compile(r"rolls < \d+")]
+PY_THREADS = re.compile(r"num_threads = os\.cpu_count\(\)")
+
+# Runs shorter than this (by the programs' own millisecond clocks) are
+# left out of the efficiencies.
+MIN_EFFICIENCY_S = 0.05
+
+
+def prepare_source(path, n, threads, threaded):
+    """Returns the source with n and, for multithreaded versions, the
+    thread count replaced. Raises ValueError if a replacement doesn't
+    apply, so no version silently runs with its own n."""
+    with open(os.path.join(ROOT, path), newline="") as f:
+        source = f.read()
+    if path.endswith(".py"):
+        source, thread_matches = PY_THREADS.subn("num_threads = %d" % threads, source)
+        source, n_matches = PY_N[0].subn(lambda m: "%sn = %d" % (m.group(1), n), source)
+        source, rolls_matches = PY_N[1].subn("rolls < %d" % n, source)
+        n_matches += rolls_matches
+    else:
+        source, thread_matches = CPP_THREADS.subn("int num_threads = %d;" % threads, source)
+        source, n_matches = CPP_N.subn(lambda m: "%s%s n = %dLL;" % (m.group(1), m.group(2), n), source, count=1)
+    if n_matches == 0:
+        raise ValueError("%s: n not found" % path)
+    if (thread_matches > 0) != threaded:
+        raise ValueError("%s: thread count %s" % (path, "not found" if threaded else "found in a single threaded version"))
+    return source
+
+
+def build(name, path, n, threads, threaded, workdir, cxx, cxxflags):
+    """Writes the prepared source and compiles it. Returns the command
+    to run it."""
+    source = prepare_source(path, n, threads, threaded)
+    base = os.path.join(workdir, "%s_%d_%d" % (name, n, threads))
+    if path.endswith(".py"):
+        with open(base + ".py", "w", newline="") as f:
+            f.write(source)
+        return [sys.executable, base + ".py"]
+    with open(base + ".cpp", "w", newline="") as f:
+        f.write(source)
+    subprocess.run([cxx] + cxxflags + ["-o", base, base + ".cpp"], check=True)
+    return [base]
+
+
+def parse_output(output, patterns):
+    def field(key, cast):
+        match = re.search(patterns.get(key, PATTERNS[key]), output, re.M)
+        return cast(match.group(1)) if match else None
+    return {
+        "result": field("result", int),
+        "sessions": field("sessions", int),
+        "reported_s": field("reported_s", float),
+    }
+
+
+def run(command, timeout, patterns):
+    """Runs one repetition. The row's status is "ok", "failed" (nonzero
+    exit code, e.g. a failed self-check) or "timeout"."""
+    start = time.perf_counter()
+    try:
+        process = subprocess.run(command, capture_output=True, text=True, timeout=timeout)
+    except subprocess.TimeoutExpired:
+        return {"status": "timeout", "returncode": None, "result": None, "sessions": None, "reported_s": None,
+                "wall_s": timeout, "elapsed_s": None, "sessions_per_s": None}
+    row = parse_output(process.stdout, patterns)
+    row["status"] = "ok" if process.returncode == 0 else "failed"
+    row["returncode"] = process.returncode
+    row["wall_s"] = time.perf_counter() - start
+    # The program's own time doesn't include start-up (or the table
+    # construction of some engines), but is the number the comments
+    # quote. Very short runs report 0, fall back to the wall time.
+    row["elapsed_s"] = row["reported_s"] or row["wall_s"]
+    row["sessions_per_s"] = row["sessions"] / row["elapsed_s"] if row["sessions"] else None
+    return row
+
+
+def parse_list(text, cast):
+    return [cast(float(x)) for x in text.split(",") if x]
+
+
+def main():
+    cpu_count = os.cpu_count() or 1
+    default_threads = sorted({1 << i for i in range(cpu_count.bit_length()) if 1 << i <= cpu_count} | {cpu_count})
+    parser = argparse.ArgumentParser(description="Strong and weak scaling benchmark over all versions.")
+    parser.add_argument("--versions", default="", help="comma separated names (default: all)")
+    parser.add_argument("--n", default="1e6,1e7,1e8", help="comma separated n for strong scaling")
+    parser.add_argument("--threads", default=",".join(map(str, default_threads)), help="comma separated thread counts")
+    parser.add_argument("--weak-base", default="1e7", help="n per thread for weak scaling (0 to skip)")
+    parser.add_argument("--reps", type=int, default=3)
+    parser.add_argument("--timeout", type=float, default=600, help="seconds per run")
+    parser.add_argument("--budget", type=float, default=60,
+                        help="skip larger n for a version once a run takes longer than this")
+    parser.add_argument("--cxx", default="g++")
+    parser.add_argument("--cxxflags", default="-O3 -mavx2 -mbmi2 -pthread")
+    parser.add_argument("--csv", help="write all runs to this CSV file, and the summary with the "
+                                      "efficiencies to <name>.summary.csv next to it")
+    parser.add_argument("--json", help="write all runs and the summary to this JSON file")
+    args = parser.parse_args()
+
+    selected = [v for v in VERSIONS if not args.versions or v[0] in args.versions.split(",")]
+    n_values = sorted(parse_list(args.n, int))
+    thread_counts = sorted(parse_list(args.threads, int))
+    weak_base = int(float(args.weak_base))
+
+    # (mode, n, threads) to run for every version.
+    grid = [("strong", n, t) for n in n_values for t in thread_counts]
+    if weak_base > 0:
+        grid += [("weak", weak_base * t, t) for t in thread_counts]
+
+    fields = ["version", "mode", "n", "threads", "rep", "status", "returncode", "wall_s", "reported_s",
+              "elapsed_s", "sessions", "sessions_per_s", "result"]
+    summary_fields = ["version", "mode", "n", "threads", "median_wall_s", "median_elapsed_s",
+                      "median_sessions_per_s", "efficiency", "results"]
+    rows = []
+    # The results so far are written even if the sweep is interrupted.
+    try:
+        with tempfile.TemporaryDirectory() as workdir:
+            for name, path, max_n, threaded, patterns in selected:
+                run_version(args, grid, workdir, rows, name, path, max_n, threaded, patterns)
+    finally:
+        summary = summarize(rows)
+        print_summary(summary)
+        if args.csv:
+            with open(args.csv, "w", newline="") as f:
+                writer = csv.DictWriter(f, fieldnames=fields)
+                writer.writeheader()
+                for row in rows:
+                    writer.writerow({k: row[k] for k in fields})
+            base, ext = os.path.splitext(args.csv)
+            with open(base + ".summary" + (ext or ".csv"), "w", newline="") as f:
+                writer = csv.DictWriter(f, fieldnames=summary_fields)
+                writer.writeheader()
+                for entry in summary:
+                    writer.writerow(dict(entry, results=" ".join(map(str, entry["results"]))))
+        if args.json:
+            with open(args.json, "w") as f:
+                json.dump({"host_threads": cpu_count, "cxxflags": args.cxxflags,
+                           "runs": rows, "summary": summary}, f, indent=2)
+
+
+def run_version(args, grid, workdir, rows, name, path, max_n, threaded, patterns):
+    """Runs one version over the grid and appends a row per run to rows.
+    Failures are recorded as rows and the version moves on to the next
+    grid point."""
+    too_slow_n = None
+    for mode, n, threads in grid:
+        if (max_n is not None and n > max_n) or (too_slow_n is not None and n >= too_slow_n):
+            continue
+        if not threaded and threads > 1:
+            continue
+        try:
+            command = build(name, path, n, threads, threaded, workdir, args.cxx, args.cxxflags.split())
+        except (ValueError, subprocess.CalledProcessError) as error:
+            print("%-10s %-6s n=%-12d threads=%-3d build failed: %s" % (name, mode, n, threads, error),
+                  file=sys.stderr)
+            rows.append({"version": name, "mode": mode, "n": n, "threads": threads, "rep": 0,
+                         "status": "build failed", "returncode": None, "wall_s": None, "reported_s": None,
+                         "elapsed_s": None, "sessions": None, "sessions_per_s": None, "result": None})
+            continue
+        for rep in range(args.reps):
+            row = run(command, args.timeout, patterns)
+            row.update({"version": name, "mode": mode, "n": n, "threads": threads, "rep": rep})
+            rows.append(row)
+            if row["status"] == "timeout" or row["wall_s"] > args.budget:
+                too_slow_n = n if too_slow_n is None else min(too_slow_n, n)
+            print("%-10s %-6s n=%-12d threads=%-3d rep=%d  %8.3fs  %.3g sessions/s  max=%s  %s"
+                  % (name, mode, n, threads, rep, row["wall_s"], row["sessions_per_s"] or 0, row["result"],
+                     row["status"]), file=sys.stderr)
+            if row["status"] != "ok":
+                break
+
+
+def summarize(rows):
+    """Median times per (version, mode, n, threads) and the efficiency
+    relative to the single thread run of the same series. Efficiencies
+    use the time the programs report, which leaves out process start-up
+    and set-up work like table construction or cross-validation. Since
+    that time has millisecond resolution, there is no efficiency if
+    either run is shorter than MIN_EFFICIENCY_S. Failed runs are left
+    out."""
+    groups = {}
+    for row in rows:
+        if row["status"] != "ok":
+            continue
+        key = (row["version"], row["mode"], row["n"], row["threads"])
+        groups.setdefault(key, []).append(row)
+
+    def median_elapsed(runs):
+        return statistics.median(r["elapsed_s"] for r in runs)
+
+    summary = []
+    for (version, mode, n, threads), runs in sorted(groups.items()):
+        rates = [r["sessions_per_s"] for r in runs if r["sessions_per_s"]]
+        entry = {"version": version, "mode": mode, "n": n, "threads": threads,
+                 "median_wall_s": statistics.median(r["wall_s"] for r in runs),
+                 "median_elapsed_s": median_elapsed(runs),
+                 "median_sessions_per_s": statistics.median(rates) if rates else None,
+                 "results": sorted({r["result"] for r in runs if r["result"] is not None}),
+                 "efficiency": None}
+        if mode == "strong":
+            base = groups.get((version, mode, n, 1))
+            speedup_base = threads
+        else:
+            base = groups.get((version, mode, n // threads, 1))
+            speedup_base = 1
+        if base and min(median_elapsed(base), entry["median_elapsed_s"]) >= MIN_EFFICIENCY_S:
+            entry["efficiency"] = median_elapsed(base) / (speedup_base * entry["median_elapsed_s"])
+        summary.append(entry)
+    return summary
+
+
+def print_summary(summary):
+    for mode, title in (("strong", "Strong Scaling"), ("weak", "Weak Scaling")):
+        entries = [e for e in summary if e["mode"] == mode]
+        if not entries:
+            continue
+        print(title + ":")
+        print("  %-10s %14s %8s %10s %10s %12s %11s  %s"
+              % ("version", "n", "threads", "wall [s]", "time [s]", "sessions/s", "efficiency", "max"))
+        for e in entries:
+            print("  %-10s %14d %8d %10.4f %10.4f %12.4g %11s  %s"
+                  % (e["version"], e["n"], e["threads"], e["median_wall_s"], e["median_elapsed_s"],
+                     e["median_sessions_per_s"] or 0,
+                     "%.2f" % e["efficiency"] if e["efficiency"] is not None else "-",
+                     ",".join(map(str, e["results"]))))
+
+
+if __name__ == "__main__":
+    main()
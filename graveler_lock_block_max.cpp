@@ -0,0 +1,281 @@
+// For the question actually asked, the highest ones roll over n sessions,
+// simulating every session is wasted work. If F is the distribution
+// function of a single session, Binomial(231, 1/4), then the maximum of
+// B independent sessions satisfies P(max <= x) = F(x)^B. So the maximum
+// of a whole block of B sessions can be drawn with a single uniform u:
+// it is the smallest x with F(x)^B >= u.
+//
+// The n sessions are split into blocks of B (plus one shorter block for
+// the remainder), each block's maximum is drawn this way and the block
+// maxima are reduced exactly like the per-thread maxima before. The tail
+// P(X > x) is summed in quadruple precision from the exact pmf and
+// F(x)^B = exp(B * log1p(-P(X > x))) is evaluated in long double, so even
+// for B = 1e12 the relevant tail of ~1e-12 is resolved to many digits.
+//
+// To make sure this really is the same quantity, the program first runs
+// the brute-force kernel of the final version R times on blocks of 4096
+// sessions and the block sampler R times with B = 4096 and compares the
+// empirical distribution of both to the exact F^4096 (Kolmogorov
+// distance). Both should be of the order 1/sqrt(R). The brute-force runs
+// are seeded through splitmix64 since short xorshift streams started
+// from small seeds produce too few ones in their first outputs.
+//
+// Doing this showed that they are not: the block sampler lands at ~0.006
+// while the brute-force kernel is off by ~0.13. The reason is the
+// generator, not the counting. Two consecutive xorshift outputs are
+// linearly related, and their AND gives sessions with a variance of
+// ~40.3 instead of the binomial 231 * 3/16 = 43.3. The mean is right,
+// but the tail, and with it the highest roll, comes out too low. To
+// show that, the same kernel is also run on independent words
+// (splitmix64 of a counter in every lane), where it lands at ~0.006 too.
+//
+// The program fails if the block sampler or the kernel on independent
+// words is further than 3/sqrt(R) from F^4096. The kernel on xorshift
+// words is only reported.
+
+// Performance on 1T (single thread): ~40ms (final version: ~1.7h)
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <cmath>
+#include <immintrin.h>
+#include <stdint.h>
+
+const int ROLLS = 231;
+
+class Xorshift64 {
+public:
+    Xorshift64(uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+        uint64_t x = state;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        state = x;
+        return x;
+    }
+
+private:
+    uint64_t state;
+};
+
+class Xorshift256 {
+public:
+    Xorshift256(__m256i seed) : state(seed) {}
+
+    __m256i next() {
+        state = _mm256_xor_si256(state, _mm256_slli_epi64(state, 13));
+        state = _mm256_xor_si256(state, _mm256_srli_epi64(state, 7));
+        state = _mm256_xor_si256(state, _mm256_slli_epi64(state, 17));
+
+        return state;
+    }
+
+private:
+    __m256i state;
+};
+
+uint64_t splitmix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// Upper tails P(X > x) of Binomial(231, 1/4) for x = 0..231.
+void binomial_tail(long double tail[ROLLS + 1]) {
+    __float128 pmf[ROLLS + 1];
+    pmf[0] = 1;
+    for (int i = 0; i < ROLLS; ++i) {
+        pmf[0] *= (__float128)3 / 4;
+    }
+    for (int k = 0; k < ROLLS; ++k) {
+        pmf[k + 1] = pmf[k] * (ROLLS - k) / (3 * (k + 1));
+    }
+    __float128 sum = 0;
+    for (int x = ROLLS; x >= 0; --x) {
+        tail[x] = (long double)sum;
+        sum += pmf[x];
+    }
+}
+
+// P(max of B sessions <= x) for x = 0..231.
+void block_max_cdf(long double cdf[ROLLS + 1], const long double tail[ROLLS + 1], long long block_size) {
+    for (int x = 0; x <= ROLLS; ++x) {
+        cdf[x] = expl((long double)block_size * log1pl(-tail[x]));
+    }
+}
+
+int inline sample_block_max(const long double cdf[ROLLS + 1], uint64_t random) {
+    long double u = ((random >> 11) + 1) * 0x1.0p-53L;
+    int lo = 0, hi = ROLLS;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (cdf[mid] >= u) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+void thread_action(long long num_blocks, std::atomic<int>& max_value, const long double* cdf, uint64_t seed){
+    Xorshift64 gen(splitmix64(seed));
+    int local_max = 0;
+    for (long long i = 0; i < num_blocks; ++i) {
+        int value = sample_block_max(cdf, gen.next());
+        local_max = (value > local_max) ? value : local_max;
+    }
+    int current = max_value;
+    while (local_max > current && !max_value.compare_exchange_weak(current, local_max)) {}
+}
+
+// Brute-force kernel of the final version, used for cross-validation.
+__m256i inline popcnt_epi8_mask(__m256i v) {
+    __m256i lookup = _mm256_setr_epi8 (0 , 1 , 1 , 2 , 1 , 2 , 2 , 3 , 1 , 2 ,
+    2 , 3 , 2 , 3 , 3 , 4 , 0 , 1 , 1 , 2 , 1 , 2 , 2 , 3 ,
+    1 , 2 , 2 , 3 , 2 , 3 , 3 , 4) ;
+    __m256i low_mask = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v, low_mask) ;
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi32(v, 4), _mm256_set1_epi64x(0x070F));
+    __m256i popcnt1 = _mm256_shuffle_epi8(lookup, lo);
+    __m256i popcnt2 = _mm256_shuffle_epi8(lookup, hi);
+    return _mm256_add_epi8(popcnt1, popcnt2);
+}
+
+__m256i inline popcnt_epi8(__m256i v) {
+    __m256i lookup = _mm256_setr_epi8 (0 , 1 , 1 , 2 , 1 , 2 , 2 , 3 , 1 , 2 ,
+    2 , 3 , 2 , 3 , 3 , 4 , 0 , 1 , 1 , 2 , 1 , 2 , 2 , 3 ,
+    1 , 2 , 2 , 3 , 2 , 3 , 3 , 4) ;
+    __m256i low_mask = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v,low_mask ) ;
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi32(v, 4), low_mask);
+    __m256i popcnt1 = _mm256_shuffle_epi8(lookup, lo);
+    __m256i popcnt2 = _mm256_shuffle_epi8(lookup, hi);
+    return _mm256_add_epi8(popcnt1, popcnt2);
+}
+
+// Independent words: splitmix64 of a counter in every lane.
+class SplitMix256 {
+public:
+    SplitMix256(__m256i seed) {
+        _mm256_storeu_si256((__m256i*)state, seed);
+    }
+
+    __m256i next() {
+        uint64_t words[4];
+        for (int i = 0; i < 4; ++i) {
+            words[i] = splitmix64(state[i]++);
+        }
+        return _mm256_loadu_si256((__m256i*)words);
+    }
+
+private:
+    uint64_t state[4];
+};
+
+template <class Generator>
+int brute_force_max(int n, __m256i seed){
+    Generator gen(seed);
+    __m256i local_max_epi8 = _mm256_setzero_si256();
+    for (int i = 0; i < n; ++i) {
+        __m256i total = popcnt_epi8_mask(_mm256_and_si256(gen.next(), gen.next()));
+        for (int j = 0; j < 3; ++j) {
+            total = _mm256_add_epi8(popcnt_epi8(_mm256_and_si256(gen.next(), gen.next())), total);
+        }
+        total = _mm256_sad_epu8(total, _mm256_setzero_si256());
+        local_max_epi8 = _mm256_max_epu8(local_max_epi8, total);
+    }
+    uint64_t result[4];
+    _mm256_storeu_si256((__m256i*)result, local_max_epi8);
+    for (int i = 1; i < 4; ++i){
+        result[0] = (result[i] > result[0]) ? result[i] : result[0];
+    }
+    return result[0];
+}
+
+// Kolmogorov distance between the empirical distribution of R maxima and cdf.
+double ks_distance(const std::vector<int>& maxima, const long double cdf[ROLLS + 1]) {
+    std::vector<long long> count(ROLLS + 1, 0);
+    for (int value : maxima) {
+        count[value]++;
+    }
+    long long below = 0;
+    double distance = 0;
+    for (int x = 0; x <= ROLLS; ++x) {
+        below += count[x];
+        distance = std::fmax(distance, std::fabs((double)below / maxima.size() - (double)cdf[x]));
+    }
+    return distance;
+}
+
+int main() {
+    long long n = 1e12;
+    long long block_size = 1e6;
+
+    long double tail[ROLLS + 1];
+    binomial_tail(tail);
+
+    const int runs = 10000;
+    const int sessions_per_run = 4096;
+    long double validation_cdf[ROLLS + 1];
+    block_max_cdf(validation_cdf, tail, sessions_per_run);
+    std::vector<int> brute_force_maxima, independent_maxima, block_maxima;
+    Xorshift64 validation_gen(splitmix64(42));
+    for (int r = 0; r < runs; ++r) {
+        __m256i seed = _mm256_setr_epi64x(splitmix64(4 * r), splitmix64(4 * r + 1), splitmix64(4 * r + 2), splitmix64(4 * r + 3));
+        brute_force_maxima.push_back(brute_force_max<Xorshift256>(sessions_per_run / 4, seed));
+        independent_maxima.push_back(brute_force_max<SplitMix256>(sessions_per_run / 4, seed));
+        block_maxima.push_back(sample_block_max(validation_cdf, validation_gen.next()));
+    }
+    double bound = 3 / std::sqrt((double)runs);
+    double brute_force_distance = ks_distance(brute_force_maxima, validation_cdf);
+    double independent_distance = ks_distance(independent_maxima, validation_cdf);
+    double block_distance = ks_distance(block_maxima, validation_cdf);
+    bool ok = independent_distance <= bound && block_distance <= bound;
+
+    int num_threads = std::thread::hardware_concurrency();
+    std::vector<std::thread> threads;
+    std::atomic<int> max_value(0);
+    long long num_blocks = n / block_size;
+    long long chunk_size = num_blocks / num_threads;
+    long long leftover_blocks = num_blocks - chunk_size * num_threads;
+    long long last_block = n - num_blocks * block_size;
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    long double cdf[ROLLS + 1], leftover_cdf[ROLLS + 1];
+    block_max_cdf(cdf, tail, block_size);
+    // The blocks that don't divide evenly among the threads are merged
+    // into one block on the main thread, together with the remainder.
+    block_max_cdf(leftover_cdf, tail, leftover_blocks * block_size + last_block);
+    for (int i = 0; i < num_threads; ++i) {
+        threads.emplace_back(thread_action, chunk_size, std::ref(max_value), cdf, 42 + i);
+    }
+    thread_action(1, max_value, leftover_cdf, 42 + num_threads);
+
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    auto total_time = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::high_resolution_clock::now() - start_time);
+
+    std::cout << "Highest Ones Roll: " << max_value << std::endl;
+    std::cout << "Number of Roll Sessions: " << n << std::endl;
+    std::cout << "In Blocks of " << block_size << " Sessions" << std::endl;
+    std::cout << "On " << num_threads << " Threads" << std::endl;
+    std::cout << "Total Elapsed Time: " << total_time.count() * 1e-6 << "s" << std::endl;
+    std::cout << "Cross-Validation on " << runs << " Runs of " << sessions_per_run << " Sessions:" << std::endl;
+    std::cout << "  Brute Force (Xorshift256) KS Distance: " << brute_force_distance << std::endl;
+    std::cout << "  Brute Force (Independent Words) KS Distance: " << independent_distance << std::endl;
+    std::cout << "  Block Sampler KS Distance: " << block_distance << std::endl;
+    std::cout << "  Bound: " << bound << (ok ? " (OK)" : " (FAIL)") << std::endl;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,459 @@
+// Every version so far was only checked by looking at the highest roll
+// it printed. That doesn't catch a kernel that counts 235 instead of 231
+// rolls, a mask that drops a nibble or a lane that gets mixed up, since
+// all of those only shift the maximum by a few. This program checks
+// every counting kernel against a scalar reference, session by session.
+//
+// Each kernel is fed the same random words (a fixed splitmix64 stream,
+// 21 words per session, of which the 32 bit kernels use the low halves, 4 sessions at a time since that's what the AVX2
+// kernels handle) in the order the kernel would take them from its
+// generator. The reference is a plain loop over an explicit list of the
+// 231 (word, bit) pairs that make up the D4 rolls of that kernel's
+// layout. For every kernel the program checks that
+//  - its layout has exactly 231 rolls and no (word, bit) is used twice,
+//    whether as the first or the second bit of a roll,
+//  - it counts 231 if every roll comes up (all words all ones, or all
+//    zeros for version 3),
+//  - it agrees with the reference on every random session.
+// The random sessions are split over all threads.
+//
+// The kernels are copies, every version being a standalone file, so
+// this only checks the versions as long as the copies are kept
+// identical to them. Whoever changes the counting code of a version
+// has to make the same change to its kernel here (and the other way
+// round) and run this program:
+//   kernel_3      the main loop of graveler_lock_py_cpp/graveler_lock_3.cpp
+//   kernel_4      the main loop of graveler_lock_4.cpp
+//   kernel_5      the main loop of graveler_lock_5.cpp
+//   kernel_6      d4count and the main loop of graveler_lock_6.cpp
+//   kernel_7      popcnt32 and the main loop of graveler_lock_py_cpp/graveler_lock_7.cpp
+//   kernel_9      popcnt64 and the loop of graveler_lock_8.cpp and graveler_lock_9.cpp
+//   kernel_10     clear_bottom_25_bits, popcnt256 of graveler_lock_10.cpp
+//   kernel_final  popcnt_epi8_mask, popcnt_epi8 and the thread_action
+//                 loop of graveler_lock_final.cpp and graveler_lock_11.cpp
+//   kernel_pipeline  count_block of graveler_lock_pipeline.cpp
+// To check a new kernel (another width, another counting trick) add a
+// count function for 4 sessions, its layout and a line in main.
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <immintrin.h>
+#include <stdint.h>
+
+const int ROLLS = 231;
+const int SESSION_WORDS = 21;
+
+uint64_t splitmix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// One roll: a 1 iff both bits are set (or, with value 0, both clear).
+struct Roll {
+    int word_a, bit_a, word_b, bit_b;
+    int value = 1;
+};
+
+typedef void (*Kernel)(const uint64_t* words, int counts[4]);
+
+// Version 3: 21 32 bit words, 11 rolls each from two adjacent bits that
+// are both 0.
+void kernel_3(const uint64_t* words, int counts[4]) {
+    for (int s = 0; s < 4; ++s) {
+        const uint64_t* w = words + s * SESSION_WORDS;
+        int value = 0;
+        for (int j = 0; j < 21; ++j) {
+            unsigned int rand_num = (uint32_t)w[j];
+            for (int k = 0; k < 11; ++k) {
+                value += (rand_num % 4 == 0);
+                rand_num /= 4;
+            }
+        }
+        counts[s] = value;
+    }
+}
+
+// Versions 3 to 6: rolls from adjacent bit pairs of consecutive words.
+std::vector<Roll> layout_pairs(int num_words, int rolls_per_word, int value, int first_word_rolls) {
+    std::vector<Roll> rolls;
+    for (int j = 0; j < num_words; ++j) {
+        int rolls_in_word = (j == 0) ? first_word_rolls : rolls_per_word;
+        for (int i = 0; i < rolls_in_word; ++i) {
+            rolls.push_back({j, 2 * i, j, 2 * i + 1, value});
+        }
+    }
+    return rolls;
+}
+
+std::vector<Roll> layout_3() {
+    return layout_pairs(21, 11, 0, 11);
+}
+
+// Version 4: both bits 1, counted one roll at a time.
+void kernel_4(const uint64_t* words, int counts[4]) {
+    for (int s = 0; s < 4; ++s) {
+        const uint64_t* w = words + s * SESSION_WORDS;
+        int value = 0;
+        for (int j = 0; j < 21; ++j) {
+            int rand_num = (uint32_t)w[j];
+            rand_num = rand_num & 0x155555 & ((rand_num & 0x2aaaaa) >> 1);
+            for (int k = 0; k < 11; ++k) {
+                value += rand_num & 1;
+                rand_num >>= 2;
+            }
+        }
+        counts[s] = value;
+    }
+}
+
+std::vector<Roll> layout_4() {
+    return layout_pairs(21, 11, 1, 11);
+}
+
+// Version 5: the same rolls, counted with a popcount.
+void kernel_5(const uint64_t* words, int counts[4]) {
+    for (int s = 0; s < 4; ++s) {
+        const uint64_t* w = words + s * SESSION_WORDS;
+        int value = 0;
+        for (int j = 0; j < 21; ++j) {
+            int rand_num = (uint32_t)w[j];
+            rand_num = rand_num & 0x155555 & ((rand_num & 0x2aaaaa) >> 1);
+            rand_num = (rand_num & 0x5555) + (rand_num >> 16);
+            rand_num = (rand_num & 0x3333) + ((rand_num >> 2) & 0x3333);
+            rand_num = (rand_num & 0x0F0F) + ((rand_num >> 4) & 0x0F0F);
+            value += (rand_num & 0x00FF) + ((rand_num >> 8) & 0x00FF);
+        }
+        counts[s] = value;
+    }
+}
+
+std::vector<Roll> layout_5() {
+    return layout_pairs(21, 11, 1, 11);
+}
+
+// Version 6: 7 rolls from the first word, 16 from each of the next 14.
+int d4count(int number){
+    number = number & 0x55555555 & ((number & 0xaaaaaaaa) >> 1);
+    number = (number & 0x5555) + (number >> 16);
+    number = (number & 0x3333) + ((number >> 2) & 0x3333);
+    number = (number & 0x0F0F) + ((number >> 4) & 0x0F0F);
+    return (number & 0x00FF) + ((number >> 8) & 0x00FF);
+}
+
+void kernel_6(const uint64_t* words, int counts[4]) {
+    for (int s = 0; s < 4; ++s) {
+        const uint64_t* w = words + s * SESSION_WORDS;
+        int rand_num = (uint32_t)w[0];
+        rand_num = rand_num & 0x1555 & ((rand_num & 0x2aaa) >> 1);
+        rand_num = (rand_num & 0x1111) + (rand_num >> 2 & 0x1111);
+        rand_num = (rand_num & 0x0f0f) + (rand_num >> 4 & 0x0f0f);
+        int value = (rand_num & 0xff) + (rand_num >> 8);
+        for (int i = 0; i < 14; ++i) {
+            value += d4count((uint32_t)w[1 + i]);
+        }
+        counts[s] = value;
+    }
+}
+
+std::vector<Roll> layout_6() {
+    return layout_pairs(15, 16, 1, 7);
+}
+
+// Version 7: 32 bit words, 7 rolls from adjacent bits of the first one.
+int popcnt32(int x) {
+    x = (x & 0x55555555) + ((x >> 1) & 0x55555555);
+    x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+    x = (x & 0x0F0F0F0F) + ((x >> 4) & 0x0F0F0F0F);
+    x = (x & 0x00FF00FF) + ((x >> 8) & 0x00FF00FF);
+    return (x & 0x0000FFFF) + ((x >> 16) & 0x0000FFFF);
+}
+
+void kernel_7(const uint64_t* words, int counts[4]) {
+    for (int s = 0; s < 4; ++s) {
+        const uint64_t* w = words + s * SESSION_WORDS;
+        int rand_num = (uint32_t)w[0];
+        rand_num = rand_num & 0x1555 & ((rand_num & 0x2aaa) >> 1);
+        rand_num = (rand_num & 0x1111) + (rand_num >> 2 & 0x1111);
+        rand_num = (rand_num & 0x0f0f) + (rand_num >> 4 & 0x0f0f);
+        int value = (rand_num & 0xff) + (rand_num >> 8);
+        for (int i = 0; i < 7; ++i) {
+            value += popcnt32((uint32_t)w[1 + 2 * i] & (uint32_t)w[2 + 2 * i]);
+        }
+        counts[s] = value;
+    }
+}
+
+std::vector<Roll> layout_7() {
+    std::vector<Roll> rolls;
+    for (int i = 0; i < 7; ++i) {
+        rolls.push_back({0, 2 * i, 0, 2 * i + 1});
+    }
+    for (int j = 0; j < 7; ++j) {
+        for (int i = 0; i < 32; ++i) {
+            rolls.push_back({1 + 2 * j, i, 2 + 2 * j, i});
+        }
+    }
+    return rolls;
+}
+
+// Versions 8 and 9: 64 bit words, the last one shifted by 25.
+int popcnt64(uint64_t x) {
+    x = (x & 0x5555555555555555) + ((x >> 1) & 0x5555555555555555);
+    x = (x & 0x3333333333333333) + ((x >> 2) & 0x3333333333333333);
+    x = (x & 0x0F0F0F0F0F0F0F0F) + ((x >> 4) & 0x0F0F0F0F0F0F0F0F);
+    x = (x & 0x00FF00FF00FF00FF) + ((x >> 8) & 0x00FF00FF00FF00FF);
+    x = (x & 0x0000FFFF0000FFFF) + ((x >> 16) & 0x0000FFFF0000FFFF);
+    x = (x & 0x00000000FFFFFFFF) + ((x >> 32) & 0x00000000FFFFFFFF);
+
+    return x;
+}
+
+void kernel_9(const uint64_t* words, int counts[4]) {
+    for (int s = 0; s < 4; ++s) {
+        const uint64_t* w = words + s * SESSION_WORDS;
+        int value = popcnt64(w[0] & w[1]);
+        value += popcnt64(w[2] & w[3]);
+        value += popcnt64(w[4] & w[5]);
+        value += popcnt64(w[6] & (w[7] >> 25));
+        counts[s] = value;
+    }
+}
+
+std::vector<Roll> layout_9() {
+    std::vector<Roll> rolls;
+    for (int j = 0; j < 3; ++j) {
+        for (int i = 0; i < 64; ++i) {
+            rolls.push_back({2 * j, i, 2 * j + 1, i});
+        }
+    }
+    for (int i = 0; i < 39; ++i) {
+        rolls.push_back({6, i, 7, i + 25});
+    }
+    return rolls;
+}
+
+// Version 10: one session per pair of 256 bit words.
+__m256i inline clear_bottom_25_bits(__m256i v) {
+    return _mm256_and_si256(v, _mm256_set_epi64x(0xFFFFFFFFFE000000ULL, 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL));
+}
+
+__m256i popcnt_epi64(__m256i v) {
+    __m256i lookup = _mm256_setr_epi8 (0 , 1 , 1 , 2 , 1 , 2 , 2 , 3 , 1 , 2 ,
+    2 , 3 , 2 , 3 , 3 , 4 , 0 , 1 , 1 , 2 , 1 , 2 , 2 , 3 ,
+    1 , 2 , 2 , 3 , 2 , 3 , 3 , 4) ;
+    __m256i low_mask = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v,low_mask ) ;
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi32(v, 4), low_mask);
+    __m256i popcnt1 = _mm256_shuffle_epi8 (lookup, lo);
+    __m256i popcnt2 = _mm256_shuffle_epi8 (lookup, hi);
+    __m256i total = _mm256_add_epi8 (popcnt1, popcnt2);
+    return _mm256_sad_epu8 (total, _mm256_setzero_si256());
+}
+
+int inline popcnt256(__m256i v) {
+    __m256i popcnt = popcnt_epi64(v);
+    uint64_t result[4];
+    _mm256_storeu_si256((__m256i*)result, popcnt);
+    return result[0] + result[1] + result[2] + result[3];
+}
+
+void kernel_10(const uint64_t* words, int counts[4]) {
+    for (int s = 0; s < 4; ++s) {
+        const uint64_t* w = words + s * SESSION_WORDS;
+        __m256i a = _mm256_loadu_si256((const __m256i*)w);
+        __m256i b = _mm256_loadu_si256((const __m256i*)(w + 4));
+        counts[s] = popcnt256(clear_bottom_25_bits(_mm256_and_si256(a, b)));
+    }
+}
+
+std::vector<Roll> layout_10() {
+    std::vector<Roll> rolls;
+    for (int j = 0; j < 3; ++j) {
+        for (int i = 0; i < 64; ++i) {
+            rolls.push_back({j, i, 4 + j, i});
+        }
+    }
+    for (int i = 25; i < 64; ++i) {
+        rolls.push_back({3, i, 7, i});
+    }
+    return rolls;
+}
+
+// Version 11 and the final version: one session per 64 bit lane of
+// eight 256 bit words.
+__m256i inline popcnt_epi8_mask(__m256i v) {
+    __m256i lookup = _mm256_setr_epi8 (0 , 1 , 1 , 2 , 1 , 2 , 2 , 3 , 1 , 2 ,
+    2 , 3 , 2 , 3 , 3 , 4 , 0 , 1 , 1 , 2 , 1 , 2 , 2 , 3 ,
+    1 , 2 , 2 , 3 , 2 , 3 , 3 , 4) ;
+    __m256i low_mask = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v, low_mask) ;
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi32(v, 4), _mm256_set1_epi64x(0x070F));
+    __m256i popcnt1 = _mm256_shuffle_epi8(lookup, lo);
+    __m256i popcnt2 = _mm256_shuffle_epi8(lookup, hi);
+    return _mm256_add_epi8(popcnt1, popcnt2);
+}
+
+__m256i inline popcnt_epi8(__m256i v) {
+    __m256i lookup = _mm256_setr_epi8 (0 , 1 , 1 , 2 , 1 , 2 , 2 , 3 , 1 , 2 ,
+    2 , 3 , 2 , 3 , 3 , 4 , 0 , 1 , 1 , 2 , 1 , 2 , 2 , 3 ,
+    1 , 2 , 2 , 3 , 2 , 3 , 3 , 4) ;
+    __m256i low_mask = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v,low_mask ) ;
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi32(v, 4), low_mask);
+    __m256i popcnt1 = _mm256_shuffle_epi8(lookup, lo);
+    __m256i popcnt2 = _mm256_shuffle_epi8(lookup, hi);
+    return _mm256_add_epi8(popcnt1, popcnt2);
+}
+
+void kernel_final(const uint64_t* words, int counts[4]) {
+    __m256i w[8];
+    for (int k = 0; k < 8; ++k) {
+        w[k] = _mm256_setr_epi64x(words[k], words[SESSION_WORDS + k], words[2 * SESSION_WORDS + k], words[3 * SESSION_WORDS + k]);
+    }
+    __m256i total = popcnt_epi8_mask(_mm256_and_si256(w[0], w[1]));
+    for (int j = 1; j < 4; ++j) {
+        total = _mm256_add_epi8(popcnt_epi8(_mm256_and_si256(w[2 * j], w[2 * j + 1])), total);
+    }
+    total = _mm256_sad_epu8(total, _mm256_setzero_si256());
+    uint64_t result[4];
+    _mm256_storeu_si256((__m256i*)result, total);
+    for (int s = 0; s < 4; ++s) {
+        counts[s] = result[s];
+    }
+}
+
+// The counting stage of the pipeline: the same, unrolled over the 8
+// words of a block.
+void kernel_pipeline(const uint64_t* words, int counts[4]) {
+    __m256i w[8];
+    for (int k = 0; k < 8; ++k) {
+        w[k] = _mm256_setr_epi64x(words[k], words[SESSION_WORDS + k], words[2 * SESSION_WORDS + k], words[3 * SESSION_WORDS + k]);
+    }
+    __m256i total = popcnt_epi8_mask(_mm256_and_si256(w[0], w[1]));
+    total = _mm256_add_epi8(popcnt_epi8(_mm256_and_si256(w[2], w[3])), total);
+    total = _mm256_add_epi8(popcnt_epi8(_mm256_and_si256(w[4], w[5])), total);
+    total = _mm256_add_epi8(popcnt_epi8(_mm256_and_si256(w[6], w[7])), total);
+    total = _mm256_sad_epu8(total, _mm256_setzero_si256());
+    uint64_t result[4];
+    _mm256_storeu_si256((__m256i*)result, total);
+    for (int s = 0; s < 4; ++s) {
+        counts[s] = result[s];
+    }
+}
+
+std::vector<Roll> layout_final() {
+    std::vector<Roll> rolls;
+    // Low nibbles of all 8 bytes, the high nibble of byte 0 and the low
+    // 3 bits of the high nibble of byte 1: 32 + 4 + 3 = 39 rolls.
+    for (int i = 0; i < 64; ++i) {
+        bool low_nibble = i % 8 < 4;
+        if (low_nibble || (i >= 4 && i < 8) || (i >= 12 && i < 15)) {
+            rolls.push_back({0, i, 1, i});
+        }
+    }
+    for (int j = 1; j < 4; ++j) {
+        for (int i = 0; i < 64; ++i) {
+            rolls.push_back({2 * j, i, 2 * j + 1, i});
+        }
+    }
+    return rolls;
+}
+
+int reference_count(const uint64_t* w, const std::vector<Roll>& rolls) {
+    int value = 0;
+    for (const Roll& r : rolls) {
+        uint64_t flip = 1 - r.value;
+        value += ((w[r.word_a] >> r.bit_a) ^ flip) & ((w[r.word_b] >> r.bit_b) ^ flip) & 1;
+    }
+    return value;
+}
+
+// Every (word, bit) is used at most once over both bits of all rolls,
+// otherwise two rolls (or the two halves of one) aren't independent.
+bool distinct_rolls(const std::vector<Roll>& rolls) {
+    std::vector<bool> used(SESSION_WORDS * 64, false);
+    for (const Roll& r : rolls) {
+        for (int position : {64 * r.word_a + r.bit_a, 64 * r.word_b + r.bit_b}) {
+            if (used[position]) {
+                return false;
+            }
+            used[position] = true;
+        }
+    }
+    return true;
+}
+
+void thread_action(long long n, std::atomic<long long>& mismatches, Kernel kernel, const std::vector<Roll>* rolls, uint64_t seed){
+    uint64_t words[4 * SESSION_WORDS];
+    int counts[4];
+    long long local_mismatches = 0;
+    for (long long i = 0; i < n; ++i) {
+        for (int k = 0; k < 4 * SESSION_WORDS; ++k) {
+            words[k] = splitmix64(seed++);
+        }
+        kernel(words, counts);
+        for (int s = 0; s < 4; ++s) {
+            local_mismatches += counts[s] != reference_count(words + s * SESSION_WORDS, *rolls);
+        }
+    }
+    mismatches += local_mismatches;
+}
+
+bool check_kernel(const char* name, Kernel kernel, const std::vector<Roll>& rolls, long long n, int num_threads) {
+    uint64_t ones[4 * SESSION_WORDS];
+    int counts[4];
+    for (int k = 0; k < 4 * SESSION_WORDS; ++k) {
+        ones[k] = rolls[0].value ? ~0ULL : 0;
+    }
+    kernel(ones, counts);
+    bool all_ones = counts[0] == ROLLS && counts[1] == ROLLS && counts[2] == ROLLS && counts[3] == ROLLS;
+    bool layout = rolls.size() == (size_t)ROLLS && distinct_rolls(rolls);
+
+    std::vector<std::thread> threads;
+    std::atomic<long long> mismatches(0);
+    long long chunk_size = n / num_threads / 4;
+    for (int i = 0; i < num_threads; ++i) {
+        threads.emplace_back(thread_action, chunk_size, std::ref(mismatches), kernel, &rolls, (uint64_t)i << 48);
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    bool ok = all_ones && layout && mismatches == 0;
+    std::cout << (ok ? "OK   " : "FAIL ") << name << ": " << counts[0] << " Rolls When All Come Up, "
+              << rolls.size() << " Rolls in Layout, " << mismatches << " of "
+              << chunk_size * num_threads * 4 << " Sessions Mismatched" << std::endl;
+    return ok;
+}
+
+int main() {
+    long long n = 1e6;
+
+    int num_threads = std::thread::hardware_concurrency();
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    bool ok = true;
+    ok &= check_kernel("Version 3 (% 4)", kernel_3, layout_3(), n, num_threads);
+    ok &= check_kernel("Version 4 (& 1)", kernel_4, layout_4(), n, num_threads);
+    ok &= check_kernel("Version 5 (popcnt, 11 rolls)", kernel_5, layout_5(), n, num_threads);
+    ok &= check_kernel("Version 6 (d4count)", kernel_6, layout_6(), n, num_threads);
+    ok &= check_kernel("Version 7 (popcnt32)", kernel_7, layout_7(), n, num_threads);
+    ok &= check_kernel("Versions 8, 9 (popcnt64)", kernel_9, layout_9(), n, num_threads);
+    ok &= check_kernel("Version 10 (popcnt256)", kernel_10, layout_10(), n, num_threads);
+    ok &= check_kernel("Version 11, Final (popcnt_epi8)", kernel_final, layout_final(), n, num_threads);
+    ok &= check_kernel("Pipeline (count_block)", kernel_pipeline, layout_final(), n, num_threads);
+
+    auto total_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::high_resolution_clock::now() - start_time);
+
+    std::cout << "On " << num_threads << " Threads" << std::endl;
+    std::cout << "Total Elapsed Time: " << total_time.count() * 1e-3 << "s" << std::endl;
+
+    return ok ? 0 : 1;
+}
@@ -109,6 +109,8 @@ __m256i inline popcnt_epi8(__m256i v) {
     return _mm256_add_epi8(popcnt1, popcnt2);
 }
 
+// The counting in this loop (and the two popcnt functions) is copied to
+// kernel_final in graveler_lock_check.cpp, change both and run the check.
 void thread_action(int n, std::atomic<int>& max_value, __m256i seed){
     Xorshift256 gen(seed);
     int local_max = 0;
@@ -126,9 +128,8 @@ void thread_action(int n, std::atomic<int>& max_value, __m256i seed){
     for (int i = 1; i < 4; ++i){
         result[0] = (result[i] > result[0]) ? result[i] : result[0];
     }
-    if (result[0] > max_value){
-        max_value = result[0];
-    }
+    int current = max_value;
+    while ((int)result[0] > current && !max_value.compare_exchange_weak(current, (int)result[0])) {}
 }
 
 int main() {
@@ -0,0 +1,389 @@
+// In the final version generating the random numbers and counting the
+// ones are fused into one loop. That's fast, but it makes it impossible
+// to measure the two separately or to try another generator without
+// touching the counting code. This version splits them into two stages
+// connected by L1-sized, 32-byte aligned blocks of random words:
+//
+//  - a generator stage fills a block of 256 __m256i (8KiB, a quarter of
+//    a typical 32KiB L1 data cache) with any generator offering
+//    __m256i next(),
+//  - a counting stage consumes the block 8 words at a time with the
+//    popcnt_epi8 family, exactly like the final version, 4 sessions
+//    per 8 words, so one block holds 128 sessions.
+//
+// The stages can run on the same core (generate a block, count it, the
+// block is still in L1) or as a producer/consumer pair of threads
+// sharing a ring of 2 blocks (16KiB, the producer fills one while the
+// consumer counts the other). Every pair is pinned on the two SMT
+// siblings of one core (from /sys/devices/system/cpu/cpu*/topology/
+// thread_siblings_list, with pthread_setaffinity_np), so the ring stays
+// in their shared L1 as long as it fits in half of it; the program
+// prints the L1d size from /sys/devices/system/cpu/cpu0/cache. Without
+// SMT the pairs run unpinned. Each stage is also timed on its own.
+//
+// Two generators are plugged in: the Xorshift256 of the final version
+// and xoshiro256++ (https://prng.di.unimi.it/), which only needs adds,
+// xors and shifts and so vectorizes just as well on AVX2. ANDing two
+// consecutive xorshift outputs is slightly correlated (the session
+// variance is ~40.3 instead of 231 * 3/16 = 43.3, see
+// graveler_lock_block_max.cpp), xoshiro256++ doesn't have that problem.
+
+// Performance on 1B (single thread, final version ~6.1sec):
+//   Xorshift256:  generation ~5.4sec, counting ~1.5sec, same core ~6.9sec
+//   Xoshiro256++: generation ~6.3sec, counting ~1.7sec, same core ~7.2sec
+// So the generator is the bottleneck, counting a hot block is 4 times
+// cheaper. On a single hardware thread (no siblings, so one unpinned
+// pair) the producer/consumer pair only measures the cost of switching
+// (~22sec).
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <pthread.h>
+#include <immintrin.h>
+#include <stdint.h>
+
+const int BLOCK_WORDS = 256;
+const int BLOCK_SESSIONS = BLOCK_WORDS / 8 * 4;
+const int RING_BLOCKS = 2;
+
+uint64_t splitmix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+class Xorshift256 {
+public:
+    Xorshift256(__m256i seed) : state(seed) {}
+
+    __m256i next() {
+        state = _mm256_xor_si256(state, _mm256_slli_epi64(state, 13));
+        state = _mm256_xor_si256(state, _mm256_srli_epi64(state, 7));
+        state = _mm256_xor_si256(state, _mm256_slli_epi64(state, 17));
+
+        return state;
+    }
+
+private:
+    __m256i state;
+};
+
+class Xoshiro256pp {
+public:
+    Xoshiro256pp(__m256i seed) {
+        uint64_t lanes[4], words[4][4];
+        _mm256_storeu_si256((__m256i*)lanes, seed);
+        for (int i = 0; i < 4; ++i) {
+            for (int j = 0; j < 4; ++j) {
+                words[j][i] = splitmix64(lanes[i] + j);
+            }
+        }
+        for (int j = 0; j < 4; ++j) {
+            s[j] = _mm256_loadu_si256((__m256i*)words[j]);
+        }
+    }
+
+    __m256i next() {
+        __m256i result = _mm256_add_epi64(rotl(_mm256_add_epi64(s[0], s[3]), 23), s[0]);
+        __m256i t = _mm256_slli_epi64(s[1], 17);
+        s[2] = _mm256_xor_si256(s[2], s[0]);
+        s[3] = _mm256_xor_si256(s[3], s[1]);
+        s[1] = _mm256_xor_si256(s[1], s[2]);
+        s[0] = _mm256_xor_si256(s[0], s[3]);
+        s[2] = _mm256_xor_si256(s[2], t);
+        s[3] = rotl(s[3], 45);
+
+        return result;
+    }
+
+private:
+    static __m256i rotl(__m256i x, int k) {
+        return _mm256_or_si256(_mm256_slli_epi64(x, k), _mm256_srli_epi64(x, 64 - k));
+    }
+
+    __m256i s[4];
+};
+
+__m256i inline popcnt_epi8_mask(__m256i v) {
+    __m256i lookup = _mm256_setr_epi8 (0 , 1 , 1 , 2 , 1 , 2 , 2 , 3 , 1 , 2 ,
+    2 , 3 , 2 , 3 , 3 , 4 , 0 , 1 , 1 , 2 , 1 , 2 , 2 , 3 ,
+    1 , 2 , 2 , 3 , 2 , 3 , 3 , 4) ;
+    __m256i low_mask = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v, low_mask) ;
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi32(v, 4), _mm256_set1_epi64x(0x070F));
+    __m256i popcnt1 = _mm256_shuffle_epi8(lookup, lo);
+    __m256i popcnt2 = _mm256_shuffle_epi8(lookup, hi);
+    return _mm256_add_epi8(popcnt1, popcnt2);
+}
+
+__m256i inline popcnt_epi8(__m256i v) {
+    __m256i lookup = _mm256_setr_epi8 (0 , 1 , 1 , 2 , 1 , 2 , 2 , 3 , 1 , 2 ,
+    2 , 3 , 2 , 3 , 3 , 4 , 0 , 1 , 1 , 2 , 1 , 2 , 2 , 3 ,
+    1 , 2 , 2 , 3 , 2 , 3 , 3 , 4) ;
+    __m256i low_mask = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v,low_mask ) ;
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi32(v, 4), low_mask);
+    __m256i popcnt1 = _mm256_shuffle_epi8(lookup, lo);
+    __m256i popcnt2 = _mm256_shuffle_epi8(lookup, hi);
+    return _mm256_add_epi8(popcnt1, popcnt2);
+}
+
+struct alignas(64) Block {
+    __m256i words[BLOCK_WORDS];
+};
+
+template <class Generator>
+void inline generate_block(Generator& gen, Block& block) {
+    for (int i = 0; i < BLOCK_WORDS; ++i) {
+        block.words[i] = gen.next();
+    }
+}
+
+// The counting in this loop is copied to kernel_pipeline in
+// graveler_lock_check.cpp, change both and run the check.
+__m256i inline count_block(const Block& block, __m256i local_max_epi8) {
+    for (int i = 0; i < BLOCK_WORDS; i += 8) {
+        const __m256i* w = block.words + i;
+        __m256i total = popcnt_epi8_mask(_mm256_and_si256(w[0], w[1]));
+        total = _mm256_add_epi8(popcnt_epi8(_mm256_and_si256(w[2], w[3])), total);
+        total = _mm256_add_epi8(popcnt_epi8(_mm256_and_si256(w[4], w[5])), total);
+        total = _mm256_add_epi8(popcnt_epi8(_mm256_and_si256(w[6], w[7])), total);
+        total = _mm256_sad_epu8(total, _mm256_setzero_si256());
+        local_max_epi8 = _mm256_max_epu8(local_max_epi8, total);
+    }
+    return local_max_epi8;
+}
+
+void inline update_max(std::atomic<int>& max_value, __m256i local_max_epi8) {
+    uint64_t result[4];
+    _mm256_storeu_si256((__m256i*)result, local_max_epi8);
+    for (int i = 1; i < 4; ++i){
+        result[0] = (result[i] > result[0]) ? result[i] : result[0];
+    }
+    int current = max_value;
+    while ((int)result[0] > current && !max_value.compare_exchange_weak(current, (int)result[0])) {}
+}
+
+// Generation stage only, the xor of all blocks keeps the compiler from
+// dropping the stores.
+template <class Generator>
+void generate_action(long long num_blocks, std::atomic<int>& sink_value, __m256i seed){
+    Generator gen(seed);
+    Block block;
+    __m256i sink = _mm256_setzero_si256();
+    for (long long i = 0; i < num_blocks; ++i) {
+        generate_block(gen, block);
+        sink = _mm256_xor_si256(sink, block.words[i % BLOCK_WORDS]);
+    }
+    sink_value.fetch_or(_mm256_testz_si256(sink, sink));
+}
+
+// Counting stage only, on one block that stays hot in L1.
+template <class Generator>
+void count_action(long long num_blocks, std::atomic<int>& max_value, __m256i seed){
+    Generator gen(seed);
+    Block block;
+    generate_block(gen, block);
+    __m256i local_max_epi8 = _mm256_setzero_si256();
+    for (long long i = 0; i < num_blocks; ++i) {
+        local_max_epi8 = count_block(block, local_max_epi8);
+        // Tell the compiler the block may have changed.
+        asm volatile("" : : "r"(&block) : "memory");
+    }
+    update_max(max_value, local_max_epi8);
+}
+
+// Both stages on the same core, every block is counted right after it
+// was generated.
+template <class Generator>
+void thread_action(long long num_blocks, std::atomic<int>& max_value, __m256i seed){
+    Generator gen(seed);
+    Block block;
+    __m256i local_max_epi8 = _mm256_setzero_si256();
+    for (long long i = 0; i < num_blocks; ++i) {
+        generate_block(gen, block);
+        local_max_epi8 = count_block(block, local_max_epi8);
+    }
+    update_max(max_value, local_max_epi8);
+}
+
+// Both stages on two threads, handing blocks over through a ring.
+struct Ring {
+    Block blocks[RING_BLOCKS];
+    alignas(64) std::atomic<long long> produced{0};
+    alignas(64) std::atomic<long long> consumed{0};
+};
+
+template <class Generator>
+void producer_action(long long num_blocks, Ring& ring, __m256i seed){
+    Generator gen(seed);
+    for (long long i = 0; i < num_blocks; ++i) {
+        while (i - ring.consumed.load(std::memory_order_acquire) >= RING_BLOCKS) {
+            std::this_thread::yield();
+        }
+        generate_block(gen, ring.blocks[i % RING_BLOCKS]);
+        ring.produced.store(i + 1, std::memory_order_release);
+    }
+}
+
+void consumer_action(long long num_blocks, std::atomic<int>& max_value, Ring& ring){
+    __m256i local_max_epi8 = _mm256_setzero_si256();
+    for (long long i = 0; i < num_blocks; ++i) {
+        while (ring.produced.load(std::memory_order_acquire) <= i) {
+            std::this_thread::yield();
+        }
+        local_max_epi8 = count_block(ring.blocks[i % RING_BLOCKS], local_max_epi8);
+        ring.consumed.store(i + 1, std::memory_order_release);
+    }
+    update_max(max_value, local_max_epi8);
+}
+
+// Size of the L1 data cache of cpu 0 (e.g. "48K"), empty if unknown.
+std::string l1d_size() {
+    for (int index = 0; ; ++index) {
+        std::string path = "/sys/devices/system/cpu/cpu0/cache/index" + std::to_string(index) + "/";
+        std::ifstream level_file(path + "level"), type_file(path + "type"), size_file(path + "size");
+        std::string level, type, size;
+        if (!std::getline(level_file, level)) {
+            return "";
+        }
+        std::getline(type_file, type);
+        std::getline(size_file, size);
+        if (level == "1" && type == "Data") {
+            return size;
+        }
+    }
+}
+
+// The first two hardware threads of every core that has at least two.
+std::vector<std::pair<int, int>> sibling_pairs() {
+    std::vector<std::pair<int, int>> pairs;
+    int num_cpus = std::thread::hardware_concurrency();
+    for (int cpu = 0; cpu < num_cpus; ++cpu) {
+        std::ifstream file("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/thread_siblings_list");
+        std::string list, range;
+        if (!std::getline(file, list)) {
+            continue;
+        }
+        // e.g. "0,6" or "0-1"
+        std::vector<int> siblings;
+        std::stringstream ranges(list);
+        while (std::getline(ranges, range, ',')) {
+            size_t dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash + 1));
+            for (int i = first; i <= last; ++i) {
+                siblings.push_back(i);
+            }
+        }
+        // Every core once, from its first sibling.
+        if (siblings.size() >= 2 && siblings[0] == cpu) {
+            pairs.emplace_back(siblings[0], siblings[1]);
+        }
+    }
+    return pairs;
+}
+
+void pin_thread(std::thread& thread, int cpu) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if (pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus) != 0) {
+        std::cerr << "Couldn't pin a thread on CPU " << cpu << std::endl;
+    }
+}
+
+// Runs action(i) on num_threads threads, thread i pinned on cpus[i] if
+// cpus is given.
+template <class Action>
+double run_threads(int num_threads, Action action, const std::vector<int>& cpus = {}) {
+    std::vector<std::thread> threads;
+    auto start_time = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < num_threads; ++i) {
+        threads.emplace_back(action, i);
+        if (!cpus.empty()) {
+            pin_thread(threads.back(), cpus[i]);
+        }
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    auto total_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::high_resolution_clock::now() - start_time);
+    return total_time.count() * 1e-3;
+}
+
+__m256i inline thread_seed(int i) {
+    return _mm256_setr_epi32(0,42 + 4 * i,0,43 + 4 * i,0,44 + 4 * i,0,45 + 4 * i);
+}
+
+template <class Generator>
+void run_pipeline(const char* name, long long n, int num_threads) {
+    long long chunk_size = n / num_threads / BLOCK_SESSIONS;
+    std::atomic<int> sink_value(0);
+    std::atomic<int> max_value(0);
+    std::atomic<int> smt_max_value(0);
+
+    double generation_time = run_threads(num_threads, [&](int i) {
+        generate_action<Generator>(chunk_size, sink_value, thread_seed(i));
+    });
+    double counting_time = run_threads(num_threads, [&](int i) {
+        count_action<Generator>(chunk_size, sink_value, thread_seed(i));
+    });
+    double same_core_time = run_threads(num_threads, [&](int i) {
+        thread_action<Generator>(chunk_size, max_value, thread_seed(i));
+    });
+
+    // One producer/consumer pair per core, producer and consumer on its
+    // two SMT siblings. Without SMT one unpinned pair per two hardware
+    // threads.
+    std::vector<std::pair<int, int>> pairs = sibling_pairs();
+    std::vector<int> cpus;
+    for (auto& pair : pairs) {
+        cpus.push_back(pair.first);
+        cpus.push_back(pair.second);
+    }
+    int num_pairs = !pairs.empty() ? pairs.size() : (num_threads > 1) ? num_threads / 2 : 1;
+    long long pair_chunk_size = n / num_pairs / BLOCK_SESSIONS;
+    std::vector<Ring> rings(num_pairs);
+    double smt_time = run_threads(2 * num_pairs, [&](int i) {
+        if (i % 2 == 0) {
+            producer_action<Generator>(pair_chunk_size, rings[i / 2], thread_seed(i / 2));
+        } else {
+            consumer_action(pair_chunk_size, smt_max_value, rings[i / 2]);
+        }
+    }, cpus);
+
+    std::cout << "Generator: " << name << std::endl;
+    std::cout << "  Highest Ones Roll: " << max_value << " (Producer/Consumer: " << smt_max_value << ")" << std::endl;
+    std::cout << "  Generation Only: " << generation_time << "s" << std::endl;
+    std::cout << "  Counting Only: " << counting_time << "s" << std::endl;
+    std::cout << "  Same Core: " << same_core_time << "s" << std::endl;
+    std::cout << "  Producer/Consumer (" << num_pairs << (pairs.empty() ? " Unpinned Pairs, No SMT" : " Pairs on SMT Siblings")
+              << "): " << smt_time << "s" << std::endl;
+}
+
+int main() {
+    long long n = 1e9;
+
+    int num_threads = std::thread::hardware_concurrency();
+
+    std::cout << "Number of Roll Sessions: " << n << std::endl;
+    std::cout << "On " << num_threads << " Threads" << std::endl;
+    std::cout << "Block Size: " << sizeof(Block) << " Bytes (" << BLOCK_SESSIONS << " Sessions)" << std::endl;
+    std::string l1d = l1d_size();
+    std::cout << "Ring Size: " << RING_BLOCKS * sizeof(Block) << " Bytes (L1d " << (l1d.empty() ? "unknown" : l1d) << ")" << std::endl;
+
+    run_pipeline<Xorshift256>("Xorshift256", n, num_threads);
+    run_pipeline<Xoshiro256pp>("Xoshiro256++", n, num_threads);
+
+    return 0;
+}
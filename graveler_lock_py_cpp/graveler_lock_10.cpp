@@ -47,7 +47,7 @@ private:
 };
 
 __m256i inline clear_bottom_25_bits(__m256i v) {
-    return _mm256_and_si256(v, _mm256_set_epi64x(0xFFFFFFFFFFE00000ULL, 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL));
+    return _mm256_and_si256(v, _mm256_set_epi64x(0xFFFFFFFFFE000000ULL, 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL));
 }
 
 __m256i popcnt_epi64(__m256i v) {
@@ -107,7 +107,7 @@ int main() {
 
     std::cout << "Highest Ones Roll: " << max_value << std::endl;
     std::cout << "Number of Roll Sessions: " << n << std::endl;
-    std::cout << "On " << num_threads << " Threads";
+    std::cout << "On " << num_threads << " Threads" << std::endl;
     std::cout << "Total Elapsed Time: " << total_time.count() * 1e-3 << "s" << std::endl;
     
     return 0;
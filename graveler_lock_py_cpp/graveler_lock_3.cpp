@@ -27,7 +27,7 @@ int main() {
     for (int i = 0; i < n; ++i) {
         int value = 0;
         for (int j = 0; j < m; ++j) {
-            int rand_num = gen();
+            unsigned int rand_num = gen();
             for (int j = 0; j < l; ++j) {
                 value += (rand_num % 4 == 0);
                 rand_num /= 4;
@@ -29,9 +29,9 @@ int main() {
     for (int i = 0; i < n; ++i) {
         int rand_num = gen();
         rand_num = rand_num & 0x1555 & ((rand_num & 0x2aaa) >> 1);
-        rand_num = (rand_num & 0x55) + (rand_num >> 4);
-        rand_num = (rand_num & 0x33) + (rand_num >> 2 & 0x33);
-        int value = (rand_num & 0x0f) + (rand_num >> 4 & 0x0f);
+        rand_num = (rand_num & 0x1111) + (rand_num >> 2 & 0x1111);
+        rand_num = (rand_num & 0x0f0f) + (rand_num >> 4 & 0x0f0f);
+        int value = (rand_num & 0xff) + (rand_num >> 8);
         for (int i = 0; i < 7; ++i) {
             value += popcnt32(gen() & gen());
         }
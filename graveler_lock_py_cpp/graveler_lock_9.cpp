@@ -81,7 +81,7 @@ int main() {
 
     std::cout << "Highest Ones Roll: " << max_value << std::endl;
     std::cout << "Number of Roll Sessions: " << n << std::endl;
-    std::cout << "On " << num_threads << " Threads";
+    std::cout << "On " << num_threads << " Threads" << std::endl;
     std::cout << "Total Elapsed Time: " << total_time.count() * 1e-3 << "s" << std::endl;
     
     return 0;
@@ -0,0 +1,339 @@
+// Sweeping the number of rolls k (say 150..300) or the threshold used
+// to mean recompiling with another mask and running everything again
+// for every point. This version simulates the sessions once for the
+// largest k and reads off every smaller k on the way.
+//
+// It uses the bit-sliced layout of graveler_lock_battle.cpp. Every bit
+// of a 256 bit word is one session, roll r of all 256 sessions is the
+// AND of two random words, and the number of ones so far is kept in 9
+// bit-planes (enough for 511 rolls). After roll r the counters hold the
+// prefix count of the first r rolls of every session, which is exactly
+// the result of a session of k = r rolls. So the sweep just looks at the
+// counters whenever r reaches a k it was asked for.
+//
+// Looking has to be cheap, or 151 values of k cost more than the rolls.
+// For every k a thread keeps its maximum so far, and the counters are
+// compared (bit-sliced, ~2 instructions per plane) against the smaller
+// of that maximum + 1 and the lowest threshold. Only if a session
+// reaches it, which quickly becomes rare, the exact maximum and the
+// number of sessions at or above every threshold are computed.
+//
+// Optionally (run_sweep<true>) every session's count is also added to a
+// histogram for every k. That needs the counters transposed back into
+// one value per session, 256 increments per k, so it is much slower and
+// only run on n / 100 sessions, for the mean and variance per k.
+//
+// As checks the program recounts the first sessions of a thread with a
+// plain scalar loop over the same random words, which must give the
+// same maximum, counts and histogram for every k, and runs the largest
+// k on its own with the same random stream, which must be identical to
+// the sweep's last row. k and the thresholds are limited to 511, the
+// largest count 9 bit-planes hold.
+//
+// The counters are turned back into values for the histogram with pdep,
+// so besides AVX2 this needs BMI2 (-mavx2 -mbmi2, or -march=native).
+
+// Performance on 100M sessions, k = 150..300, thresholds 100, 120, 177
+// (single thread): ~1.6sec for the sweep, ~1.2sec for k = 300 alone.
+// Running all 151 values of k one by one would take ~130sec.
+// With the histograms the sweep takes ~0.2sec per 1M sessions.
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <immintrin.h>
+#include <stdint.h>
+
+const int K_MAX = 511;
+const int COUNTER_BITS = 9;
+const int SESSIONS_PER_VECTOR = 256;
+
+uint64_t splitmix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+class Xoshiro256pp {
+public:
+    Xoshiro256pp(__m256i seed) {
+        uint64_t lanes[4], words[4][4];
+        _mm256_storeu_si256((__m256i*)lanes, seed);
+        for (int i = 0; i < 4; ++i) {
+            for (int j = 0; j < 4; ++j) {
+                words[j][i] = splitmix64(lanes[i] + j);
+            }
+        }
+        for (int j = 0; j < 4; ++j) {
+            s[j] = _mm256_loadu_si256((__m256i*)words[j]);
+        }
+    }
+
+    __m256i next() {
+        __m256i result = _mm256_add_epi64(rotl(_mm256_add_epi64(s[0], s[3]), 23), s[0]);
+        __m256i t = _mm256_slli_epi64(s[1], 17);
+        s[2] = _mm256_xor_si256(s[2], s[0]);
+        s[3] = _mm256_xor_si256(s[3], s[1]);
+        s[1] = _mm256_xor_si256(s[1], s[2]);
+        s[0] = _mm256_xor_si256(s[0], s[3]);
+        s[2] = _mm256_xor_si256(s[2], t);
+        s[3] = rotl(s[3], 45);
+
+        return result;
+    }
+
+private:
+    static __m256i rotl(__m256i x, int k) {
+        return _mm256_or_si256(_mm256_slli_epi64(x, k), _mm256_srli_epi64(x, 64 - k));
+    }
+
+    __m256i s[4];
+};
+
+// Sessions whose counter is >= value.
+__m256i inline at_least(const __m256i counter[COUNTER_BITS], int value) {
+    __m256i greater = _mm256_setzero_si256();
+    __m256i equal = _mm256_set1_epi8(-1);
+    for (int b = COUNTER_BITS - 1; b >= 0; --b) {
+        if ((value >> b) & 1) {
+            equal = _mm256_and_si256(equal, counter[b]);
+        } else {
+            greater = _mm256_or_si256(greater, _mm256_and_si256(equal, counter[b]));
+            equal = _mm256_andnot_si256(counter[b], equal);
+        }
+    }
+    return _mm256_or_si256(greater, equal);
+}
+
+// Largest counter among the sessions in mask (mask must not be empty).
+int inline maximum(const __m256i counter[COUNTER_BITS], __m256i mask) {
+    int value = 0;
+    for (int b = COUNTER_BITS - 1; b >= 0; --b) {
+        __m256i with_bit = _mm256_and_si256(mask, counter[b]);
+        if (!_mm256_testz_si256(with_bit, with_bit)) {
+            mask = with_bit;
+            value |= 1 << b;
+        }
+    }
+    return value;
+}
+
+int inline popcnt256(__m256i v) {
+    return _mm_popcnt_u64(_mm256_extract_epi64(v, 0)) + _mm_popcnt_u64(_mm256_extract_epi64(v, 1))
+         + _mm_popcnt_u64(_mm256_extract_epi64(v, 2)) + _mm_popcnt_u64(_mm256_extract_epi64(v, 3));
+}
+
+// Adds the counter of every session to histogram.
+void inline add_to_histogram(const __m256i counter[COUNTER_BITS], long long* histogram) {
+    uint64_t planes[COUNTER_BITS][4];
+    for (int b = 0; b < COUNTER_BITS; ++b) {
+        _mm256_storeu_si256((__m256i*)planes[b], counter[b]);
+    }
+    for (int w = 0; w < 4; ++w) {
+        for (int s = 0; s < 64; s += 8) {
+            // The low 8 bit-planes of 8 sessions into 8 bytes, the 9th apart.
+            uint64_t low = 0;
+            for (int b = 0; b < 8; ++b) {
+                low |= _pdep_u64(planes[b][w] >> s, 0x0101010101010101ULL << b);
+            }
+            uint64_t high = planes[8][w] >> s;
+            for (int j = 0; j < 8; ++j) {
+                histogram[((low >> (8 * j)) & 0xff) | (((high >> j) & 1) << 8)]++;
+            }
+        }
+    }
+}
+
+struct SweepTable {
+    std::vector<int> max_value;                     // per k
+    std::vector<std::vector<long long>> at_least;   // per k, per threshold
+    std::vector<std::vector<long long>> histogram;  // per k, per count (run_sweep<true> only)
+
+    SweepTable(int num_k, int num_thresholds, bool with_histogram)
+        : max_value(num_k, 0), at_least(num_k, std::vector<long long>(num_thresholds, 0)),
+          histogram(with_histogram ? num_k : 0, std::vector<long long>(K_MAX + 1, 0)) {}
+};
+
+template <bool HISTOGRAM>
+void thread_action(long long n, SweepTable& table, int k_min, int k_max, const std::vector<int>* thresholds, __m256i seed){
+    Xoshiro256pp gen(seed);
+    int num_thresholds = thresholds->size();
+    int lowest_threshold = K_MAX + 1;
+    for (int t : *thresholds) {
+        lowest_threshold = (t < lowest_threshold) ? t : lowest_threshold;
+    }
+    for (long long i = 0; i < n; ++i) {
+        __m256i counter[COUNTER_BITS];
+        for (int b = 0; b < COUNTER_BITS; ++b) {
+            counter[b] = _mm256_setzero_si256();
+        }
+        for (int r = 1; r <= k_max; ++r) {
+            // counter += roll, ripple carry through the bit-planes.
+            __m256i carry = _mm256_and_si256(gen.next(), gen.next());
+            for (int b = 0; b < COUNTER_BITS; ++b) {
+                __m256i next_carry = _mm256_and_si256(counter[b], carry);
+                counter[b] = _mm256_xor_si256(counter[b], carry);
+                carry = next_carry;
+            }
+            if (r < k_min) {
+                continue;
+            }
+            int k = r - k_min;
+            if (HISTOGRAM) {
+                add_to_histogram(counter, table.histogram[k].data());
+            }
+            int floor = (table.max_value[k] + 1 < lowest_threshold) ? table.max_value[k] + 1 : lowest_threshold;
+            __m256i candidates = at_least(counter, floor);
+            if (_mm256_testz_si256(candidates, candidates)) {
+                continue;
+            }
+            int value = maximum(counter, candidates);
+            table.max_value[k] = (value > table.max_value[k]) ? value : table.max_value[k];
+            for (int t = 0; t < num_thresholds; ++t) {
+                if ((*thresholds)[t] <= value) {
+                    table.at_least[k][t] += popcnt256(at_least(counter, (*thresholds)[t]));
+                }
+            }
+        }
+    }
+}
+
+__m256i inline thread_seed(int i) {
+    return _mm256_setr_epi32(0,42 + 4 * i,0,43 + 4 * i,0,44 + 4 * i,0,45 + 4 * i);
+}
+
+template <bool HISTOGRAM>
+SweepTable run_sweep(long long n, int num_threads, int k_min, int k_max, const std::vector<int>& thresholds) {
+    std::vector<std::thread> threads;
+    std::vector<SweepTable> tables(num_threads, SweepTable(k_max - k_min + 1, thresholds.size(), HISTOGRAM));
+    long long chunk_size = n / num_threads / SESSIONS_PER_VECTOR;
+
+    for (int i = 0; i < num_threads; ++i) {
+        threads.emplace_back(thread_action<HISTOGRAM>, chunk_size, std::ref(tables[i]), k_min, k_max, &thresholds, thread_seed(i));
+    }
+
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    SweepTable table = tables[0];
+    for (int i = 1; i < num_threads; ++i) {
+        for (int k = 0; k <= k_max - k_min; ++k) {
+            table.max_value[k] = (tables[i].max_value[k] > table.max_value[k]) ? tables[i].max_value[k] : table.max_value[k];
+            for (size_t t = 0; t < thresholds.size(); ++t) {
+                table.at_least[k][t] += tables[i].at_least[k][t];
+            }
+            for (int v = 0; HISTOGRAM && v <= K_MAX; ++v) {
+                table.histogram[k][v] += tables[i].histogram[k][v];
+            }
+        }
+    }
+    return table;
+}
+
+// Recounts the first num_vectors * 256 sessions of thread 0 one session
+// and one roll at a time from the same random words and compares the
+// whole table, histogram included, with the bit-sliced sweep.
+bool check_sweep(long long num_vectors, int k_min, int k_max, const std::vector<int>& thresholds) {
+    SweepTable sweep(k_max - k_min + 1, thresholds.size(), true);
+    thread_action<true>(num_vectors, sweep, k_min, k_max, &thresholds, thread_seed(0));
+
+    SweepTable reference(k_max - k_min + 1, thresholds.size(), true);
+    Xoshiro256pp gen(thread_seed(0));
+    for (long long i = 0; i < num_vectors; ++i) {
+        int counts[SESSIONS_PER_VECTOR] = {};
+        for (int r = 1; r <= k_max; ++r) {
+            uint64_t roll[4];
+            __m256i a = gen.next();
+            __m256i b = gen.next();
+            _mm256_storeu_si256((__m256i*)roll, _mm256_and_si256(a, b));
+            for (int s = 0; s < SESSIONS_PER_VECTOR; ++s) {
+                counts[s] += (roll[s / 64] >> (s % 64)) & 1;
+            }
+            if (r < k_min) {
+                continue;
+            }
+            int k = r - k_min;
+            for (int s = 0; s < SESSIONS_PER_VECTOR; ++s) {
+                reference.max_value[k] = (counts[s] > reference.max_value[k]) ? counts[s] : reference.max_value[k];
+                reference.histogram[k][counts[s]]++;
+                for (size_t t = 0; t < thresholds.size(); ++t) {
+                    reference.at_least[k][t] += counts[s] >= thresholds[t];
+                }
+            }
+        }
+    }
+    return sweep.max_value == reference.max_value && sweep.at_least == reference.at_least
+        && sweep.histogram == reference.histogram;
+}
+
+int main() {
+    long long n = 1e9;
+    int k_min = 150;
+    int k_max = 300;
+    std::vector<int> thresholds = {100, 120, 177};
+    long long histogram_n = n / 100;
+
+    if (k_min < 1 || k_max < k_min || k_max > K_MAX) {
+        std::cout << "Rolls must be within 1.." << K_MAX << std::endl;
+        return 1;
+    }
+    for (int t : thresholds) {
+        if (t < 0 || t > K_MAX) {
+            std::cout << "Thresholds must be within 0.." << K_MAX << std::endl;
+            return 1;
+        }
+    }
+
+    int num_threads = std::thread::hardware_concurrency();
+    long long sessions = n / num_threads / SESSIONS_PER_VECTOR * SESSIONS_PER_VECTOR * num_threads;
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+    SweepTable sweep = run_sweep<false>(n, num_threads, k_min, k_max, thresholds);
+    auto sweep_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::high_resolution_clock::now() - start_time);
+
+    start_time = std::chrono::high_resolution_clock::now();
+    SweepTable single = run_sweep<false>(n, num_threads, k_max, k_max, thresholds);
+    auto single_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::high_resolution_clock::now() - start_time);
+
+    start_time = std::chrono::high_resolution_clock::now();
+    SweepTable histograms = run_sweep<true>(histogram_n, num_threads, k_min, k_max, thresholds);
+    auto histogram_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::high_resolution_clock::now() - start_time);
+
+    bool same = single.max_value[0] == sweep.max_value.back() && single.at_least[0] == sweep.at_least.back();
+    bool scalar_same = check_sweep(64, k_min, k_max, thresholds);
+
+    std::cout << "Rolls  Highest Ones Roll";
+    for (int t : thresholds) {
+        std::cout << "  >= " << t;
+    }
+    std::cout << "  Mean  Variance" << std::endl;
+    for (int k = k_min; k <= k_max; ++k) {
+        std::cout << k << "  " << sweep.max_value[k - k_min];
+        for (size_t t = 0; t < thresholds.size(); ++t) {
+            std::cout << "  " << sweep.at_least[k - k_min][t];
+        }
+        double count = 0, mean = 0, second_moment = 0;
+        for (int v = 0; v <= K_MAX; ++v) {
+            count += histograms.histogram[k - k_min][v];
+            mean += (double)v * histograms.histogram[k - k_min][v];
+            second_moment += (double)v * v * histograms.histogram[k - k_min][v];
+        }
+        mean /= count;
+        std::cout << "  " << mean << "  " << second_moment / count - mean * mean << std::endl;
+    }
+    std::cout << "Number of Roll Sessions: " << sessions << " (Mean and Variance: " << histogram_n << ")" << std::endl;
+    std::cout << "On " << num_threads << " Threads" << std::endl;
+    std::cout << "Sweep Elapsed Time: " << sweep_time.count() * 1e-3 << "s" << std::endl;
+    std::cout << "Single k = " << k_max << " Elapsed Time: " << single_time.count() * 1e-3 << "s" << std::endl;
+    std::cout << "Histogram Sweep Elapsed Time: " << histogram_time.count() * 1e-3 << "s" << std::endl;
+    std::cout << "Single k = " << k_max << " Matches Sweep: " << (same ? "yes" : "no") << std::endl;
+    std::cout << "Scalar Recount Matches Sweep: " << (scalar_same ? "yes" : "no") << std::endl;
+
+    return (same && scalar_same) ? 0 : 1;
+}
@@ -0,0 +1,272 @@
+// The final version still spends 8 * 256 random bits on every session
+// only to popcount them down to a single number, which is always
+// Binomial(231, 1/4) distributed. This engine skips the dice entirely
+// and samples that number directly: one 64-bit uniform per session.
+//
+// The sampler is Walker's alias method with 256 columns. The top 8 bits
+// of the uniform pick a column, the remaining 56 bits are compared to
+// the column's threshold and decide between the column itself and its
+// alias. Threshold and alias are packed into one 64-bit table entry, so
+// four sessions cost one xorshift step, one gather and a compare-blend.
+//
+// The table is built from the exact distribution computed in quadruple
+// precision and rounded to integer masses that sum to exactly 2^64.
+// Given a uniform u, the alias method then reproduces these masses
+// exactly, so the only bias is the rounding: every value is off by less
+// than 2^-64 in probability, values far out in the tails (true
+// probability below 2^-64) may not occur at all, and any tail
+// P(X >= k) is off by less than 232 * 2^-64.
+// For anything reachable in a simulation (1e12 sessions see tail
+// probabilities down to ~1e-12, while 2^-64 ~ 5.4e-20) this is far
+// below the noise. The program checks the table against the exact
+// distribution before running and prints the largest deviation. It
+// also runs the vectorized select of the hot loop on both sides of
+// every column's threshold, so a flipped compare or blend fails too.
+//
+// Since every session now yields its value directly, a full histogram
+// of the ones roll comes cheaply next to the maximum. Each of the four
+// lanes counts into its own histogram so consecutive increments of the
+// same value don't stall on each other.
+
+// Performance on 1B (single thread, final version ~6.1sec): ~1.6sec
+// Without the histogram the same loop takes ~1.1sec.
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <immintrin.h>
+#include <stdint.h>
+
+const int ROLLS = 231;
+const int COLUMNS = 256;
+const uint64_t THRESHOLD_MASK = (1ULL << 56) - 1;
+
+class Xorshift256 {
+public:
+    Xorshift256(__m256i seed) : state(seed) {}
+
+    __m256i next() {
+        state = _mm256_xor_si256(state, _mm256_slli_epi64(state, 13));
+        state = _mm256_xor_si256(state, _mm256_srli_epi64(state, 7));
+        state = _mm256_xor_si256(state, _mm256_slli_epi64(state, 17));
+
+        return state;
+    }
+
+private:
+    __m256i state;
+};
+
+// Exact probabilities of 0..231 ones, P(k+1) = P(k) * (231 - k) / (3 * (k + 1)).
+void binomial_pmf(__float128 pmf[ROLLS + 1]) {
+    pmf[0] = 1;
+    for (int i = 0; i < ROLLS; ++i) {
+        pmf[0] *= (__float128)3 / 4;
+    }
+    for (int k = 0; k < ROLLS; ++k) {
+        pmf[k + 1] = pmf[k] * (ROLLS - k) / (3 * (k + 1));
+    }
+}
+
+// Rounds the pmf to integer masses summing to exactly 2^64
+// (largest remainder), then builds the packed alias table:
+// entry = alias << 56 | threshold.
+void build_alias_table(uint64_t table[COLUMNS], unsigned __int128 mass[ROLLS + 1]) {
+    const __float128 two64 = (__float128)(1ULL << 32) * (1ULL << 32);
+    const unsigned __int128 total = (unsigned __int128)1 << 64;
+    const unsigned __int128 column = (unsigned __int128)1 << 56;
+
+    __float128 pmf[ROLLS + 1];
+    __float128 remainder[ROLLS + 1];
+    binomial_pmf(pmf);
+    unsigned __int128 sum = 0;
+    for (int k = 0; k <= ROLLS; ++k) {
+        __float128 scaled = pmf[k] * two64;
+        mass[k] = (unsigned __int128)scaled;
+        remainder[k] = scaled - (__float128)mass[k];
+        sum += mass[k];
+    }
+    while (sum < total) {
+        int best = 0;
+        for (int k = 1; k <= ROLLS; ++k) {
+            best = (remainder[k] > remainder[best]) ? k : best;
+        }
+        mass[best] += 1;
+        remainder[best] -= 1;
+        sum += 1;
+    }
+
+    unsigned __int128 left[COLUMNS];
+    int small[COLUMNS], large[COLUMNS];
+    int num_small = 0, num_large = 0;
+    for (int c = 0; c < COLUMNS; ++c) {
+        left[c] = (c <= ROLLS) ? mass[c] : 0;
+        if (left[c] < column) {
+            small[num_small++] = c;
+        } else {
+            large[num_large++] = c;
+        }
+    }
+    while (num_small > 0 && num_large > 0) {
+        int s = small[--num_small];
+        int l = large[num_large - 1];
+        table[s] = ((uint64_t)l << 56) | (uint64_t)left[s];
+        left[l] -= column - left[s];
+        if (left[l] < column) {
+            --num_large;
+            small[num_small++] = l;
+        }
+    }
+    // Whatever is left holds exactly one full column.
+    while (num_large > 0) {
+        int l = large[--num_large];
+        table[l] = ((uint64_t)l << 56) | THRESHOLD_MASK;
+    }
+}
+
+// Recomputes the mass every value receives from the table and compares
+// it to the rounded masses and to the exact distribution. Returns the
+// largest deviation from the exact probabilities, or -1 if the table
+// doesn't reproduce the rounded masses.
+double check_alias_table(const uint64_t table[COLUMNS], const unsigned __int128 mass[ROLLS + 1]) {
+    const __float128 two64 = (__float128)(1ULL << 32) * (1ULL << 32);
+    const unsigned __int128 column = (unsigned __int128)1 << 56;
+
+    unsigned __int128 received[COLUMNS] = {};
+    for (int c = 0; c < COLUMNS; ++c) {
+        uint64_t threshold = table[c] & THRESHOLD_MASK;
+        // A full column keeps the whole 2^56, including u = 2^56 - 1.
+        unsigned __int128 own = (threshold == THRESHOLD_MASK) ? column : threshold;
+        received[c] += own;
+        received[table[c] >> 56] += column - own;
+    }
+    __float128 pmf[ROLLS + 1];
+    binomial_pmf(pmf);
+    double max_bias = 0;
+    for (int k = 0; k < COLUMNS; ++k) {
+        if (received[k] != ((k <= ROLLS) ? mass[k] : 0)) {
+            return -1;
+        }
+        if (k <= ROLLS) {
+            double bias = (double)((__float128)mass[k] / two64 - pmf[k]);
+            bias = (bias < 0) ? -bias : bias;
+            max_bias = (bias > max_bias) ? bias : max_bias;
+        }
+    }
+    return max_bias;
+}
+
+// The value of 4 sessions from their uniforms: the column (top 8 bits)
+// if the low 56 bits are below its threshold, its alias otherwise.
+__m256i inline alias_select(const uint64_t* table, __m256i u) {
+    const __m256i threshold_mask = _mm256_set1_epi64x(THRESHOLD_MASK);
+    __m256i col = _mm256_srli_epi64(u, 56);
+    __m256i entry = _mm256_i64gather_epi64((const long long*)table, col, 8);
+    __m256i own = _mm256_cmpgt_epi64(_mm256_and_si256(entry, threshold_mask), _mm256_and_si256(u, threshold_mask));
+    return _mm256_blendv_epi8(_mm256_srli_epi64(entry, 56), col, own);
+}
+
+// Runs alias_select on u = (c << 56 | threshold - 1), which has to give
+// c, and u = (c << 56 | threshold), which has to give the alias, for
+// every column c.
+bool check_alias_select(const uint64_t table[COLUMNS]) {
+    for (int c = 0; c < COLUMNS; c += 2) {
+        uint64_t u[4], expected[4], value[4];
+        for (int j = 0; j < 2; ++j) {
+            uint64_t threshold = table[c + j] & THRESHOLD_MASK;
+            uint64_t top = (uint64_t)(c + j) << 56;
+            // A threshold of 0 has no own side, test the alias twice.
+            u[2 * j] = top | (threshold > 0 ? threshold - 1 : 0);
+            expected[2 * j] = threshold > 0 ? c + j : table[c + j] >> 56;
+            u[2 * j + 1] = top | threshold;
+            expected[2 * j + 1] = table[c + j] >> 56;
+        }
+        _mm256_storeu_si256((__m256i*)value, alias_select(table, _mm256_loadu_si256((const __m256i*)u)));
+        for (int j = 0; j < 4; ++j) {
+            if (value[j] != expected[j]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void thread_action(long long n, std::atomic<int>& max_value, std::vector<uint64_t>& histogram, const uint64_t* table, __m256i seed){
+    Xorshift256 gen(seed);
+    uint64_t local_histogram[4][ROLLS + 1] = {};
+    __m256i local_max_epi64 = _mm256_setzero_si256();
+    for (long long i = 0; i < n; ++i) {
+        __m256i value = alias_select(table, gen.next());
+        local_max_epi64 = _mm256_max_epu8(local_max_epi64, value);
+        local_histogram[0][_mm256_extract_epi64(value, 0)]++;
+        local_histogram[1][_mm256_extract_epi64(value, 1)]++;
+        local_histogram[2][_mm256_extract_epi64(value, 2)]++;
+        local_histogram[3][_mm256_extract_epi64(value, 3)]++;
+    }
+    uint64_t result[4];
+    _mm256_storeu_si256((__m256i*)result, local_max_epi64);
+    for (int i = 1; i < 4; ++i){
+        result[0] = (result[i] > result[0]) ? result[i] : result[0];
+    }
+    int current = max_value;
+    while ((int)result[0] > current && !max_value.compare_exchange_weak(current, (int)result[0])) {}
+    for (int k = 0; k <= ROLLS; ++k) {
+        histogram[k] = local_histogram[0][k] + local_histogram[1][k] + local_histogram[2][k] + local_histogram[3][k];
+    }
+}
+
+int main() {
+    long long n = 1e9;
+
+    alignas(32) uint64_t table[COLUMNS];
+    unsigned __int128 mass[ROLLS + 1];
+    build_alias_table(table, mass);
+    double max_bias = check_alias_table(table, mass);
+    if (max_bias < 0) {
+        std::cout << "Alias table doesn't reproduce the binomial distribution" << std::endl;
+        return 1;
+    }
+    if (!check_alias_select(table)) {
+        std::cout << "Alias select doesn't pick the column below its threshold and the alias above" << std::endl;
+        return 1;
+    }
+
+    int num_threads = std::thread::hardware_concurrency();
+    std::vector<std::thread> threads;
+    std::atomic<int> max_value(0);
+    std::vector<std::vector<uint64_t>> histograms(num_threads, std::vector<uint64_t>(ROLLS + 1));
+    long long chunk_size = n / num_threads / 4;
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    for (int i = 0; i < num_threads; ++i) {
+        threads.emplace_back(thread_action, chunk_size, std::ref(max_value), std::ref(histograms[i]), table, _mm256_setr_epi32(0,42 + 4 * i,0,43 + 4 * i,0,44 + 4 * i,0,45 + 4 * i));
+    }
+
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    auto total_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::high_resolution_clock::now() - start_time);
+
+    std::cout << "Ones Roll Histogram:" << std::endl;
+    for (int k = 0; k <= ROLLS; ++k) {
+        uint64_t count = 0;
+        for (int i = 0; i < num_threads; ++i) {
+            count += histograms[i][k];
+        }
+        if (count > 0) {
+            std::cout << "  " << k << ": " << count << std::endl;
+        }
+    }
+    std::cout << "Highest Ones Roll: " << max_value << std::endl;
+    std::cout << "Number of Roll Sessions: " << n << std::endl;
+    std::cout << "On " << num_threads << " Threads" << std::endl;
+    std::cout << "Max Table Bias: " << max_bias << std::endl;
+    std::cout << "Total Elapsed Time: " << total_time.count() * 1e-3 << "s" << std::endl;
+
+    return 0;
+}